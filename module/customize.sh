@@ -46,9 +46,8 @@ done
 BASE_DIR="/data/adb/hymo"
 mkdir -p "$BASE_DIR"
 
-# Install createimg.sh
-cp "$MODPATH/createimg.sh" "$BASE_DIR/createimg.sh"
-chmod 755 "$BASE_DIR/createimg.sh"
+# hymod provisions modules.img itself; drop the script older versions installed
+rm -f "$BASE_DIR/createimg.sh"
 
 # Handle Config
 if [ ! -f "$BASE_DIR/config.toml" ]; then
@@ -56,37 +55,9 @@ if [ ! -f "$BASE_DIR/config.toml" ]; then
   cat "$MODPATH/config.toml" > "$BASE_DIR/config.toml"
 fi
 
-# Handle Image Creation (Borrowed from meta-overlayfs)
-IMG_FILE="$BASE_DIR/modules.img"
-IMG_SIZE_MB=2048
-
-# Check if force_ext4 is enabled in config
-FORCE_EXT4=false
-if [ -f "$BASE_DIR/config.toml" ]; then
-    if grep -q "force_ext4 = true" "$BASE_DIR/config.toml"; then
-        FORCE_EXT4=true
-        ui_print "- Force Ext4 mode enabled in config"
-    fi
-fi
-
-if [ ! -f "$IMG_FILE" ]; then
-    # Check if kernel supports tmpfs
-    if grep -q "tmpfs" /proc/filesystems && [ "$FORCE_EXT4" = false ]; then
-        ui_print "- Kernel supports tmpfs. Skipping ext4 image creation."
-    else
-        if [ "$FORCE_EXT4" = true ]; then
-             ui_print "- Creating 2GB ext4 image (Forced Mode)..."
-        else
-             ui_print "- Creating 2GB ext4 image for module storage..."
-        fi
-        
-        sh "$BASE_DIR/createimg.sh" "$BASE_DIR" "$IMG_SIZE_MB"
-        
-        if [ $? -ne 0 ]; then
-            ui_print "! Failed to format ext4 image"
-        fi
-    fi
-else
+# modules.img is created by hymod on first mount when tmpfs is unavailable or
+# force_ext4 is set, sized from the module content
+if [ -f "$BASE_DIR/modules.img" ]; then
     ui_print "- Reusing existing modules.img"
 fi
 
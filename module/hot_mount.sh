@@ -12,5 +12,5 @@ rm -f "/data/adb/hymo/run/hot_unmounted/$MODULE_ID"
 # Enable module (if it was disabled normally)
 rm -f "/data/adb/modules/$MODULE_ID/disable"
 
-# Use targeted add command instead of full reload
-/data/adb/modules/hymo/hymod add "$MODULE_ID"
+# Targeted reload: syncs this module into the mirror and adds only its rules
+/data/adb/modules/hymo/hymod reload --module "$MODULE_ID"
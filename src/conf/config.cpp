@@ -54,6 +54,22 @@ Config Config::from_file(const fs::path& path) {
             else if (key == "ignore_protocol_mismatch") config.ignore_protocol_mismatch = (value == "true");
             else if (key == "enable_kernel_debug") config.enable_kernel_debug = (value == "true");
             else if (key == "enable_stealth") config.enable_stealth = (value == "true");
+            else if (key == "sync_hash") config.sync_hash = (value == "true");
+            else if (key == "copy_strategy") config.copy_strategy = value;
+            else if (key == "io_backend") config.io_backend = value;
+            else if (key == "enable_dedup") config.enable_dedup = (value == "true");
+            else if (key == "mirror_backend") config.mirror_backend = value;
+            else if (key == "image_journal") config.image_journal = (value == "true");
+            else if (key == "trim_image") config.trim_image = (value == "true");
+            else if (key == "plan_cache") config.plan_cache = (value == "true");
+            else if (key == "compact_rules") config.compact_rules = (value == "true");
+            else if (key == "sync_threads") {
+                try {
+                    config.sync_threads = std::stoi(value);
+                } catch (...) {
+                    LOG_WARN("Invalid sync_threads value: " + value);
+                }
+            }
             else if (key == "partitions") {
                 std::stringstream ss(value);
                 std::string part;
@@ -92,6 +108,16 @@ bool Config::save_to_file(const fs::path& path) const {
     file << "ignore_protocol_mismatch = " << (ignore_protocol_mismatch ? "true" : "false") << "\n";
     file << "enable_kernel_debug = " << (enable_kernel_debug ? "true" : "false") << "\n";
     file << "enable_stealth = " << (enable_stealth ? "true" : "false") << "\n";
+    file << "sync_threads = " << sync_threads << "\n";
+    file << "sync_hash = " << (sync_hash ? "true" : "false") << "\n";
+    file << "copy_strategy = \"" << copy_strategy << "\"\n";
+    file << "io_backend = \"" << io_backend << "\"\n";
+    file << "enable_dedup = " << (enable_dedup ? "true" : "false") << "\n";
+    file << "mirror_backend = \"" << mirror_backend << "\"\n";
+    file << "image_journal = " << (image_journal ? "true" : "false") << "\n";
+    file << "trim_image = " << (trim_image ? "true" : "false") << "\n";
+    file << "plan_cache = " << (plan_cache ? "true" : "false") << "\n";
+    file << "compact_rules = " << (compact_rules ? "true" : "false") << "\n";
     
     // Write partitions
     if (!partitions.empty()) {
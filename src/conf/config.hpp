@@ -26,6 +26,16 @@ struct Config {
     bool ignore_protocol_mismatch = false;
     bool enable_kernel_debug = false;
     bool enable_stealth = true; // Default to true
+    int sync_threads = 0; // 0 = auto (CPU count, capped)
+    bool sync_hash = false; // Also compare content hashes in the sync manifest
+    std::string copy_strategy = "auto"; // auto, copy_file_range, sendfile, readwrite
+    std::string io_backend = "auto"; // auto, uring, sync (batched scan/copy of small files)
+    bool enable_dedup = true; // Hardlink identical files across modules in storage
+    std::string mirror_backend = "copy"; // copy, bind, erofs (HymoFS mirror source)
+    bool image_journal = false; // Format a newly created modules.img with an ext4 journal
+    bool trim_image = false; // FITRIM modules.img after syncs free space (makes the image sparse)
+    bool plan_cache = true; // Replay the last boot's plan and HymoFS rules when no input changed
+    bool compact_rules = false; // One HymoFS directory rule for module-only directories (kernel must support it)
     std::vector<std::string> partitions;
     std::map<std::string, std::string> module_modes;
     std::map<std::string, std::vector<ModuleRuleConfig>> module_rules;
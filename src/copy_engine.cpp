@@ -0,0 +1,331 @@
+// copy_engine.cpp - Kernel-assisted file copy implementation
+#include "copy_engine.hpp"
+#include "defs.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+
+namespace hymo {
+
+namespace {
+
+struct AtomicCounters {
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> nanos{0};
+
+    CopyStrategyCounters snapshot() const {
+        return CopyStrategyCounters{files.load(), bytes.load(), nanos.load()};
+    }
+    void reset() {
+        files = 0;
+        bytes = 0;
+        nanos = 0;
+    }
+};
+
+AtomicCounters g_cfr;
+AtomicCounters g_sendfile;
+AtomicCounters g_rw;
+std::atomic<uint64_t> g_hole_bytes{0};
+std::atomic<uint64_t> g_fallbacks{0};
+std::atomic<uint64_t> g_failures{0};
+
+std::atomic<int> g_strategy{static_cast<int>(CopyStrategy::Auto)};
+// Cleared the first time the kernel tells us a strategy can never work here
+// (ENOSYS, or EXDEV for copy_file_range across filesystems)
+std::atomic<bool> g_cfr_usable{true};
+std::atomic<bool> g_sendfile_usable{true};
+
+constexpr size_t RW_BUFFER_SIZE = 1024 * 1024;
+
+enum class ChunkResult { Ok, Unsupported, Failed };
+
+ssize_t sys_copy_file_range(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len) {
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, 0u);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+bool is_unsupported_errno(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP ||
+           err == ENOTSUP || err == EPERM || err == ETXTBSY;
+}
+
+// Each copy_range_* adds what it wrote to copied, so a fallback can resume after it
+ChunkResult copy_range_cfr(int in, int out, off_t off, uint64_t len, uint64_t& copied) {
+    loff_t in_off = off;
+    loff_t out_off = off;
+    while (len > 0) {
+        ssize_t n = sys_copy_file_range(in, &in_off, out, &out_off, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOSYS || errno == EXDEV) g_cfr_usable = false;
+            return is_unsupported_errno(errno) ? ChunkResult::Unsupported : ChunkResult::Failed;
+        }
+        if (n == 0) break; // Source shrank underneath us
+        len -= n;
+        copied += n;
+    }
+    return ChunkResult::Ok;
+}
+
+ChunkResult copy_range_sendfile(int in, int out, off_t off, uint64_t len, uint64_t& copied) {
+    if (lseek(out, off, SEEK_SET) < 0) {
+        return ChunkResult::Failed;
+    }
+    off_t in_off = off;
+    while (len > 0) {
+        size_t chunk = len > 0x7ffff000ULL ? 0x7ffff000UL : (size_t)len;
+        ssize_t n = sendfile(out, in, &in_off, chunk);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOSYS) g_sendfile_usable = false;
+            return is_unsupported_errno(errno) ? ChunkResult::Unsupported : ChunkResult::Failed;
+        }
+        if (n == 0) break;
+        len -= n;
+        copied += n;
+    }
+    return ChunkResult::Ok;
+}
+
+ChunkResult copy_range_rw(int in, int out, off_t off, uint64_t len, uint64_t& copied) {
+    static thread_local std::unique_ptr<char[]> buf(new char[RW_BUFFER_SIZE]);
+    while (len > 0) {
+        size_t want = len > RW_BUFFER_SIZE ? RW_BUFFER_SIZE : (size_t)len;
+        ssize_t n = pread(in, buf.get(), want, off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return ChunkResult::Failed;
+        }
+        if (n == 0) break;
+
+        ssize_t done = 0;
+        while (done < n) {
+            ssize_t w = pwrite(out, buf.get() + done, n - done, off + done);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return ChunkResult::Failed;
+            }
+            done += w;
+        }
+        off += n;
+        len -= n;
+        copied += n;
+    }
+    return ChunkResult::Ok;
+}
+
+// Copy one data extent, starting with the preferred strategy and falling
+// back down the chain when the kernel refuses it. Bytes are credited to the
+// strategy that wrote them; *used is the one that finished the extent
+bool copy_range(int in, int out, off_t off, uint64_t len, AtomicCounters** used) {
+    int first = g_strategy.load();
+    if (first == static_cast<int>(CopyStrategy::Auto)) {
+        first = static_cast<int>(CopyStrategy::CopyFileRange);
+    }
+
+    for (int s = first; s <= static_cast<int>(CopyStrategy::ReadWrite); ++s) {
+        auto strategy = static_cast<CopyStrategy>(s);
+        AtomicCounters* counters = nullptr;
+        ChunkResult result = ChunkResult::Unsupported;
+        uint64_t copied = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        if (strategy == CopyStrategy::CopyFileRange) {
+            if (!g_cfr_usable) continue;
+            counters = &g_cfr;
+            result = copy_range_cfr(in, out, off, len, copied);
+        } else if (strategy == CopyStrategy::Sendfile) {
+            if (!g_sendfile_usable) continue;
+            counters = &g_sendfile;
+            result = copy_range_sendfile(in, out, off, len, copied);
+        } else {
+            counters = &g_rw;
+            result = copy_range_rw(in, out, off, len, copied);
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        counters->bytes += copied;
+        counters->nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+        if (result == ChunkResult::Ok) {
+            *used = counters;
+            return true;
+        }
+        if (result == ChunkResult::Failed) {
+            return false;
+        }
+        // Unsupported: the refused call wrote nothing, so the next strategy picks up
+        // right after what this one already copied
+        off += copied;
+        len -= copied;
+        g_fallbacks++;
+    }
+    return false;
+}
+
+} // namespace
+
+CopyStrategy parse_copy_strategy(const std::string& name) {
+    if (name == "copy_file_range") return CopyStrategy::CopyFileRange;
+    if (name == "sendfile") return CopyStrategy::Sendfile;
+    if (name == "readwrite" || name == "read_write") return CopyStrategy::ReadWrite;
+    return CopyStrategy::Auto;
+}
+
+const char* copy_strategy_name(CopyStrategy strategy) {
+    switch (strategy) {
+        case CopyStrategy::CopyFileRange: return "copy_file_range";
+        case CopyStrategy::Sendfile: return "sendfile";
+        case CopyStrategy::ReadWrite: return "readwrite";
+        default: return "auto";
+    }
+}
+
+void set_copy_strategy(CopyStrategy strategy) {
+    g_strategy = static_cast<int>(strategy);
+}
+
+bool copy_file_fast(const fs::path& src, const fs::path& dst, mode_t mode, const std::string& context) {
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (in < 0) {
+        LOG_ERROR("copy: cannot open " + src.string() + ": " + strerror(errno));
+        g_failures++;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        g_failures++;
+        return false;
+    }
+
+    // Created private, then fchmod'ed so the umask never leaks into the mirror
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (out < 0) {
+        LOG_ERROR("copy: cannot create " + dst.string() + ": " + strerror(errno));
+        close(in);
+        g_failures++;
+        return false;
+    }
+
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    bool ok = true;
+    uint64_t size = st.st_size;
+    uint64_t data_bytes = 0;
+    AtomicCounters* used = &g_rw;
+
+    // Size the file first so skipped ranges stay holes
+    if (size > 0 && ftruncate(out, size) != 0) {
+        ok = false;
+    }
+
+    off_t pos = 0;
+    while (ok && (uint64_t)pos < size) {
+        off_t data = lseek(in, pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break;     // Only a hole is left
+            data = pos;                     // No SEEK_DATA support: treat as dense
+        }
+        off_t hole = lseek(in, data, SEEK_HOLE);
+        if (hole < 0 || hole <= data) {
+            hole = size;
+        }
+        if ((uint64_t)hole > size) {
+            hole = size;
+        }
+
+        ok = copy_range(in, out, data, hole - data, &used);
+        data_bytes += hole - data;
+        pos = hole;
+    }
+
+    if (ok && fchmod(out, mode & 07777) != 0) {
+        LOG_WARN("copy: fchmod failed for " + dst.string() + ": " + strerror(errno));
+    }
+#ifdef __ANDROID__
+    if (ok && !context.empty()) {
+        if (fsetxattr(out, SELINUX_XATTR, context.c_str(), context.length(), 0) != 0) {
+            LOG_DEBUG("copy: fsetfilecon failed for " + dst.string() + ": " + strerror(errno));
+        }
+    }
+#endif
+
+    // Boot-time mirror copies are read once; don't let them evict the page cache
+    posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+
+    close(in);
+    if (close(out) != 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        LOG_ERROR("copy: failed to copy " + src.string() + " -> " + dst.string() + ": " + strerror(errno));
+        unlink(dst.c_str());
+        g_failures++;
+        return false;
+    }
+
+    used->files++;
+    if (size > data_bytes) {
+        g_hole_bytes += size - data_bytes;
+    }
+    return true;
+}
+
+CopyStats get_copy_stats() {
+    CopyStats stats;
+    stats.copy_file_range = g_cfr.snapshot();
+    stats.sendfile = g_sendfile.snapshot();
+    stats.read_write = g_rw.snapshot();
+    stats.hole_bytes = g_hole_bytes.load();
+    stats.fallbacks = g_fallbacks.load();
+    stats.failures = g_failures.load();
+    return stats;
+}
+
+void reset_copy_stats() {
+    g_cfr.reset();
+    g_sendfile.reset();
+    g_rw.reset();
+    g_hole_bytes = 0;
+    g_fallbacks = 0;
+    g_failures = 0;
+}
+
+static std::string format_counters(const char* name, const CopyStrategyCounters& c) {
+    char buf[160];
+    double secs = c.nanos / 1e9;
+    double mbps = secs > 0 ? (c.bytes / (1024.0 * 1024.0)) / secs : 0.0;
+    snprintf(buf, sizeof(buf), "%s %llu files %.1f MiB %.1f MiB/s",
+             name, (unsigned long long)c.files, c.bytes / (1024.0 * 1024.0), mbps);
+    return buf;
+}
+
+std::string format_copy_stats(const CopyStats& stats) {
+    std::string out = format_counters("copy_file_range", stats.copy_file_range) + " | " +
+                      format_counters("sendfile", stats.sendfile) + " | " +
+                      format_counters("readwrite", stats.read_write);
+    out += " | holes " + std::to_string(stats.hole_bytes / 1024) + " KiB";
+    out += " | fallbacks " + std::to_string(stats.fallbacks);
+    out += " | failures " + std::to_string(stats.failures);
+    return out;
+}
+
+} // namespace hymo
@@ -0,0 +1,52 @@
+// copy_engine.hpp - Kernel-assisted file copy with throughput counters
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <filesystem>
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+enum class CopyStrategy {
+    Auto,          // copy_file_range -> sendfile -> read/write, falling back on error
+    CopyFileRange,
+    Sendfile,
+    ReadWrite
+};
+
+CopyStrategy parse_copy_strategy(const std::string& name);
+const char* copy_strategy_name(CopyStrategy strategy);
+
+// Process-wide preferred strategy (from config); later strategies stay as fallbacks
+void set_copy_strategy(CopyStrategy strategy);
+
+// Copy src to a new file dst (must not exist) with the given mode and SELinux
+// context. Holes in src are preserved and src pages are dropped from the page cache.
+bool copy_file_fast(const fs::path& src, const fs::path& dst, mode_t mode, const std::string& context);
+
+// bytes and nanos cover what a strategy itself wrote, including extents it started
+// before falling back; files counts the files whose last extent it finished
+struct CopyStrategyCounters {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    uint64_t nanos = 0;
+};
+
+struct CopyStats {
+    CopyStrategyCounters copy_file_range;
+    CopyStrategyCounters sendfile;
+    CopyStrategyCounters read_write;
+    uint64_t hole_bytes = 0;  // bytes skipped because they were holes in the source
+    uint64_t fallbacks = 0;   // times a strategy failed and the next one took over
+    uint64_t failures = 0;
+};
+
+CopyStats get_copy_stats();
+void reset_copy_stats();
+// One-line human readable summary, e.g. for the daemon log
+std::string format_copy_stats(const CopyStats& stats);
+
+} // namespace hymo
@@ -0,0 +1,116 @@
+// core/applied_rules.cpp - Record of the HymoFS rules applied in this boot implementation
+#include "applied_rules.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <dirent.h>
+
+namespace hymo {
+
+static constexpr const char* RULES_HEADER = "hymo-applied-rules 2";
+
+// Changes on every boot; kernel rules never outlive it
+static std::string current_boot_id() {
+    std::ifstream file("/proc/sys/kernel/random/boot_id");
+    std::string id;
+    std::getline(file, id);
+    return id;
+}
+
+bool load_applied_rules(HymoRules& rules) {
+    std::ifstream file(APPLIED_RULES_FILE);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    std::string boot_id = current_boot_id();
+    if (!std::getline(file, line) || line != RULES_HEADER) {
+        return false;
+    }
+    if (boot_id.empty() || !std::getline(file, line) || line != "boot_id\t" + boot_id) {
+        return false;
+    }
+
+    HymoRules loaded;
+    while (std::getline(file, line)) {
+        if (line == "end") {
+            rules = std::move(loaded);
+            return true;
+        }
+        // <kind>\t<module>\t..., module empty for rules no module contributed
+        size_t t1 = line.find('\t');
+        size_t t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+        std::string key = line.substr(0, t1);
+        if (key == "hide" && t2 != std::string::npos) {
+            std::string path = line.substr(t2 + 1);
+            if (t2 > t1 + 1) loaded.owners[path] = line.substr(t1 + 1, t2 - t1 - 1);
+            loaded.hide_rules.push_back(std::move(path));
+            continue;
+        }
+        size_t t3 = t2 == std::string::npos ? t2 : line.find('\t', t2 + 1);
+        size_t t4 = t3 == std::string::npos ? t3 : line.find('\t', t3 + 1);
+        if (key != "add" || t4 == std::string::npos) {
+            break;
+        }
+        int type = rule_type_from_name(line.substr(t2 + 1, t3 - t2 - 1));
+        if (type < 0) {
+            break;
+        }
+        std::string src = line.substr(t3 + 1, t4 - t3 - 1);
+        if (t2 > t1 + 1) loaded.owners[src] = line.substr(t1 + 1, t2 - t1 - 1);
+        loaded.add_rules.push_back(HymoAddRule{std::move(src), line.substr(t4 + 1), type});
+    }
+    LOG_WARN("Ignoring unreadable record of applied HymoFS rules");
+    return false;
+}
+
+bool save_applied_rules(const HymoRules& rules) {
+    std::string boot_id = current_boot_id();
+    if (boot_id.empty()) {
+        forget_applied_rules();
+        return false;
+    }
+
+    std::ostringstream out;
+    out << RULES_HEADER << "\n";
+    out << "boot_id\t" << boot_id << "\n";
+    auto owner = [&](const std::string& path) -> const std::string& {
+        static const std::string none;
+        auto it = rules.owners.find(path);
+        return it == rules.owners.end() ? none : it->second;
+    };
+    for (const auto& rule : rules.add_rules) {
+        const std::string& module = owner(rule.src);
+        if (rule.src.find_first_of("\t\n") != std::string::npos || rule.target.find('\n') != std::string::npos ||
+            module.find_first_of("\t\n") != std::string::npos) {
+            forget_applied_rules();
+            return false;
+        }
+        out << "add\t" << module << "\t" << rule_type_name(rule.type) << "\t" << rule.src << "\t" << rule.target << "\n";
+    }
+    for (const auto& path : rules.hide_rules) {
+        const std::string& module = owner(path);
+        if (path.find('\n') != std::string::npos || module.find_first_of("\t\n") != std::string::npos) {
+            forget_applied_rules();
+            return false;
+        }
+        out << "hide\t" << module << "\t" << path << "\n";
+    }
+    out << "end\n";
+
+    if (!write_file_atomic(APPLIED_RULES_FILE, out.str())) {
+        forget_applied_rules();
+        return false;
+    }
+    return true;
+}
+
+void forget_applied_rules() {
+    std::error_code ec;
+    fs::remove(APPLIED_RULES_FILE, ec);
+}
+
+} // namespace hymo
@@ -0,0 +1,18 @@
+// core/applied_rules.hpp - Record of the HymoFS rules applied in this boot
+#pragma once
+
+#include "planner.hpp"
+
+namespace hymo {
+
+// Rules last applied by apply_hymofs_rules(), with the module each came from, so a
+// module's rules can be removed without looking at its files. False if there is no
+// record, it was written before the last reboot, or it can't be read; the kernel
+// state is then unknown.
+bool load_applied_rules(HymoRules& rules);
+bool save_applied_rules(const HymoRules& rules);
+
+// Call after changing kernel rules by other means, so the next apply starts from scratch
+void forget_applied_rules();
+
+} // namespace hymo
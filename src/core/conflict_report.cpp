@@ -0,0 +1,66 @@
+// core/conflict_report.cpp - Which HymoFS module shadows which implementation
+#include "conflict_report.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+namespace hymo {
+
+static constexpr const char* REPORT_HEADER = "hymo-conflicts 1";
+
+bool load_conflict_report(HymoConflictReport& report) {
+    std::ifstream file(HYMOFS_CONFLICTS_FILE);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != REPORT_HEADER) {
+        return false;
+    }
+
+    HymoConflictReport loaded;
+    while (std::getline(file, line)) {
+        auto f = split_tabs(line);
+        if (f[0] == "end" && f.size() == 1) {
+            report = std::move(loaded);
+            return true;
+        } else if (f[0] == "module" && f.size() == 3) {
+            try {
+                loaded.provided[f[1]] = std::stoul(f[2]);
+            } catch (...) {
+                break;
+            }
+        } else if (f[0] == "path" && f.size() >= 4) {
+            loaded.conflicts.push_back(HymoConflict{f[1], f[2], std::vector<std::string>(f.begin() + 3, f.end())});
+        } else {
+            break;
+        }
+    }
+    LOG_WARN("Ignoring unreadable HymoFS conflict report");
+    return false;
+}
+
+bool save_conflict_report(const HymoConflictReport& report) {
+    std::ostringstream out;
+    out << REPORT_HEADER << "\n";
+    for (const auto& [id, count] : report.provided) {
+        out << "module\t" << id << "\t" << count << "\n";
+    }
+    for (const auto& conflict : report.conflicts) {
+        // Not representable in the line format; rare enough to leave out
+        if (conflict.path.find_first_of("\t\n") != std::string::npos) continue;
+        out << "path\t" << conflict.path << "\t" << conflict.winner;
+        for (const auto& id : conflict.shadowed) {
+            out << "\t" << id;
+        }
+        out << "\n";
+    }
+    out << "end\n";
+
+    return write_file_atomic(HYMOFS_CONFLICTS_FILE, out.str());
+}
+
+} // namespace hymo
@@ -0,0 +1,13 @@
+// core/conflict_report.hpp - Which HymoFS module shadows which
+#pragma once
+
+#include "planner.hpp"
+
+namespace hymo {
+
+// Report of the last time HymoFS rules were built (replayed plans keep the one
+// written with them). False if there is none or it can't be read.
+bool load_conflict_report(HymoConflictReport& report);
+bool save_conflict_report(const HymoConflictReport& report);
+
+} // namespace hymo
@@ -0,0 +1,183 @@
+// core/dedup.cpp - Content-addressed deduplication implementation
+#include "dedup.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include "../walker.hpp"
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace hymo {
+
+// Files smaller than this fit in the slack of an inode/page and are not worth a link
+static constexpr off_t DEDUP_MIN_SIZE = 4096;
+
+static bool files_equal(const fs::path& a, const fs::path& b) {
+    int fa = open(a.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fa < 0) return false;
+    int fb = open(b.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fb < 0) {
+        close(fa);
+        return false;
+    }
+
+    static thread_local char buf_a[64 * 1024];
+    static thread_local char buf_b[64 * 1024];
+    bool equal = true;
+    while (equal) {
+        ssize_t na = read(fa, buf_a, sizeof(buf_a));
+        ssize_t nb = read(fb, buf_b, sizeof(buf_b));
+        if (na < 0 || nb < 0 || na != nb) {
+            equal = false;
+        } else if (na == 0) {
+            break;
+        } else {
+            equal = memcmp(buf_a, buf_b, na) == 0;
+        }
+    }
+
+    close(fa);
+    close(fb);
+    return equal;
+}
+
+// Everything a hardlink shares must be part of the key, not just the bytes
+static std::string store_key(uint64_t hash, const struct stat& st, const std::string& context) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%016llx-%llx-%o-%u-%u-%08zx",
+             (unsigned long long)hash, (unsigned long long)st.st_size,
+             (unsigned)(st.st_mode & 07777), (unsigned)st.st_uid, (unsigned)st.st_gid,
+             std::hash<std::string>{}(context) & 0xffffffffu);
+    return buf;
+}
+
+static bool link_to_store(const fs::path& file, const struct stat& st, const fs::path& store, DedupReport& report) {
+    uint64_t hash = 0;
+    if (!hash_file(file, hash)) {
+        return false;
+    }
+
+    fs::path entry = store / store_key(hash, st, lgetfilecon(file));
+
+    // First file with this content becomes the store copy
+    if (link(file.c_str(), entry.c_str()) == 0) {
+        return true;
+    }
+    if (errno != EEXIST) {
+        LOG_DEBUG("dedup: cannot link " + file.string() + ": " + strerror(errno));
+        return false;
+    }
+
+    struct stat entry_st;
+    if (lstat(entry.c_str(), &entry_st) != 0) {
+        return false;
+    }
+    if (entry_st.st_ino == st.st_ino && entry_st.st_dev == st.st_dev) {
+        return true;
+    }
+
+    // The hash is not cryptographic: compare bytes before sharing an inode
+    if (!files_equal(file, entry)) {
+        LOG_DEBUG("dedup: hash collision on " + file.string());
+        return false;
+    }
+
+    // Swap the file for a link to the store copy atomically
+    fs::path tmp = file.parent_path() / (".hymo_dedup." + file.filename().string());
+    unlink(tmp.c_str());
+    if (link(entry.c_str(), tmp.c_str()) != 0) {
+        return false;
+    }
+    if (rename(tmp.c_str(), file.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    report.files_linked++;
+    report.bytes_linked += (uint64_t)st.st_blocks * 512;
+    return true;
+}
+
+static DedupReport dedup_module(const fs::path& module_root, const fs::path& store) {
+    DedupReport report;
+    std::error_code ec = walk_tree(module_root, [&](const WalkEntry& entry) {
+        const struct stat& st = entry.st;
+        if (!S_ISREG(st.st_mode)) {
+            return WalkAction::Continue;
+        }
+        report.files_scanned++;
+
+        // Already shared with the store (or another module) from an earlier pass
+        if (st.st_nlink > 1 || st.st_size < DEDUP_MIN_SIZE) {
+            return WalkAction::Continue;
+        }
+        link_to_store(entry.path(), st, store, report);
+        return WalkAction::Continue;
+    });
+
+    if (ec) {
+        LOG_WARN("dedup: scan of " + module_root.string() + " stopped: " + ec.message());
+    }
+    return report;
+}
+
+// Payload count and savings of the store. With collect, entries no module links to
+// any more are dropped; only a sync may do that, since a payload it just created is
+// unlinked until the module file is linked to it.
+static DedupReport scan_store(const fs::path& storage_root, bool collect) {
+    DedupReport report;
+    fs::path store = storage_root / DEDUP_STORE_DIR_NAME;
+    std::error_code ec;
+
+    for (const auto& entry : fs::directory_iterator(store, ec)) {
+        struct stat st;
+        if (lstat(entry.path().c_str(), &st) != 0) {
+            continue;
+        }
+        if (st.st_nlink <= 1) {
+            if (collect) unlink(entry.path().c_str());
+            continue;
+        }
+        report.unique_payloads++;
+        // One copy is always needed; every further module link is a saved copy
+        report.bytes_saved += (uint64_t)(st.st_nlink - 2) * st.st_blocks * 512;
+    }
+    return report;
+}
+
+DedupReport measure_dedup_store(const fs::path& storage_root) {
+    return scan_store(storage_root, false);
+}
+
+DedupReport dedup_storage(const fs::path& storage_root, const std::vector<std::string>& module_ids, int threads) {
+    fs::path store = storage_root / DEDUP_STORE_DIR_NAME;
+    if (!ensure_dir_exists(store)) {
+        return {};
+    }
+    chmod(store.c_str(), 0700);
+
+    std::atomic<uint64_t> scanned{0}, linked{0}, bytes{0};
+    run_parallel(module_ids.size(), resolve_worker_count(threads, module_ids.size()), [&](size_t i) {
+        DedupReport r = dedup_module(storage_root / module_ids[i], store);
+        scanned += r.files_scanned;
+        linked += r.files_linked;
+        bytes += r.bytes_linked;
+    });
+
+    DedupReport report = scan_store(storage_root, true);
+    report.files_scanned = scanned;
+    report.files_linked = linked;
+    report.bytes_linked = bytes;
+
+    LOG_INFO("Dedup: linked " + std::to_string(report.files_linked) + " of " +
+             std::to_string(report.files_scanned) + " files (" + std::to_string(report.bytes_linked / 1024) +
+             " KiB freed), " + std::to_string(report.unique_payloads) + " stored payloads saving " +
+             std::to_string(report.bytes_saved / 1024) + " KiB");
+    return report;
+}
+
+} // namespace hymo
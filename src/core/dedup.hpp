@@ -0,0 +1,30 @@
+// core/dedup.hpp - Content-addressed deduplication of synced module files
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+struct DedupReport {
+    uint64_t files_scanned = 0;
+    uint64_t files_linked = 0;    // files replaced by a hardlink during this pass
+    uint64_t bytes_linked = 0;    // storage released by this pass
+    uint64_t unique_payloads = 0; // entries left in the store
+    uint64_t bytes_saved = 0;     // total storage currently saved by sharing
+};
+
+// Hardlink identical files (same content, mode, owner and SELinux label) of the given
+// modules to a single inode kept in <storage_root>/.hymo_store. Paths inside the
+// module trees stay where they are, so rules and layers keep pointing at them.
+// Afterwards, store entries no module links to any more are dropped.
+DedupReport dedup_storage(const fs::path& storage_root, const std::vector<std::string>& module_ids, int threads);
+
+// Current savings of the store, without changing it (safe during a sync)
+DedupReport measure_dedup_store(const fs::path& storage_root);
+
+} // namespace hymo
@@ -0,0 +1,574 @@
+// core/erofs.cpp - In-process EROFS image builder implementation
+//
+// Writes the plain (uncompressed) EROFS layout understood by every kernel with
+// CONFIG_EROFS_FS: 4 KiB blocks, extended inodes, inline xattrs and tail-packed
+// inline data. Metadata starts at block 1, file payloads follow it.
+#include "erofs.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <sys/sysmacros.h>
+
+namespace hymo {
+
+namespace {
+
+constexpr uint32_t EROFS_MAGIC = 0xE0F5E1E2;
+constexpr uint32_t EROFS_SUPER_OFFSET = 1024;
+constexpr uint32_t BLOCK_BITS = 12;
+constexpr uint32_t BLOCK_SIZE = 1u << BLOCK_BITS;
+constexpr uint32_t META_BLKADDR = 1;
+constexpr uint32_t INODE_SLOT = 32;        // nid granularity
+constexpr uint32_t INODE_EXTENDED_SIZE = 64;
+constexpr uint32_t XATTR_IBODY_HEADER_SIZE = 12;
+constexpr uint32_t DIRENT_SIZE = 12;
+
+constexpr uint8_t LAYOUT_FLAT_PLAIN = 0;
+constexpr uint8_t LAYOUT_FLAT_INLINE = 2;
+
+constexpr uint8_t XATTR_INDEX_TRUSTED = 4;
+constexpr uint8_t XATTR_INDEX_SECURITY = 6;
+
+// Bump whenever the produced layout changes so old images get rebuilt
+constexpr uint64_t WRITER_VERSION = 1;
+
+struct Xattr {
+    uint8_t index;
+    std::string name; // without the prefix implied by index
+    std::string value;
+};
+
+struct Inode {
+    fs::path source;
+    struct stat st;
+    std::string link_target;
+    std::vector<Xattr> xattrs;
+    std::vector<std::pair<std::string, uint32_t>> entries; // directories: name -> inode, sorted
+    uint32_t parent = 0;
+    uint32_t nlink = 1;
+
+    // Layout
+    uint64_t size = 0;
+    uint64_t meta_offset = 0; // from the start of the metadata area
+    uint32_t xattr_size = 0;
+    uint32_t inline_size = 0;
+    uint32_t blkaddr = 0;
+    uint8_t layout = LAYOUT_FLAT_PLAIN;
+    std::vector<uint32_t> dir_block_starts; // first entry index of each directory block
+};
+
+struct Tree {
+    std::vector<Inode> inodes; // [0] is the root
+    uint64_t stamp = 0;
+};
+
+inline void put16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+inline void put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (v >> (8 * i)) & 0xff;
+}
+inline void put64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (v >> (8 * i)) & 0xff;
+}
+inline uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+inline uint64_t get64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+inline uint64_t align_up(uint64_t v, uint64_t a) {
+    return (v + a - 1) / a * a;
+}
+
+// FNV-1a, fed field by field
+struct StampHasher {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    void add(const void* data, size_t len) {
+        auto* p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            h ^= p[i];
+            h *= 0x100000001b3ULL;
+        }
+    }
+    void add(const std::string& s) {
+        add(s.data(), s.size());
+        add("\0", 1);
+    }
+    void add(uint64_t v) { add(&v, sizeof(v)); }
+};
+
+uint8_t dirent_type(mode_t mode) {
+    switch (mode & S_IFMT) {
+        case S_IFREG: return 1;
+        case S_IFDIR: return 2;
+        case S_IFCHR: return 3;
+        case S_IFBLK: return 4;
+        case S_IFIFO: return 5;
+        case S_IFSOCK: return 6;
+        case S_IFLNK: return 7;
+        default: return 0;
+    }
+}
+
+uint32_t encode_dev(dev_t dev) {
+    uint32_t ma = major(dev);
+    uint32_t mi = minor(dev);
+    return (mi & 0xff) | (ma << 8) | ((mi & ~0xffu) << 12);
+}
+
+// Recursively add src (already lstat'ed) below parent, deduplicating hardlinks
+bool scan_node(Tree& tree, const fs::path& src, const fs::path& rel, const struct stat& st, uint32_t parent,
+               const ErofsLabelFn& label, std::map<std::pair<dev_t, ino_t>, uint32_t>& links,
+               StampHasher& hasher, uint32_t& out_index) {
+    if (!S_ISDIR(st.st_mode) && st.st_nlink > 1) {
+        auto it = links.find({st.st_dev, st.st_ino});
+        if (it != links.end()) {
+            tree.inodes[it->second].nlink++;
+            hasher.add(rel.string());
+            hasher.add((uint64_t)it->second);
+            out_index = it->second;
+            return true;
+        }
+    }
+
+    uint32_t index = tree.inodes.size();
+    tree.inodes.emplace_back();
+    {
+        Inode& node = tree.inodes.back();
+        node.source = src;
+        node.st = st;
+        node.parent = parent;
+    }
+    if (!S_ISDIR(st.st_mode) && st.st_nlink > 1) {
+        links[{st.st_dev, st.st_ino}] = index;
+    }
+
+    std::string context = label ? label(rel, st.st_mode) : "";
+    std::string link_target;
+    std::string opaque;
+
+    if (S_ISLNK(st.st_mode)) {
+        std::error_code ec;
+        link_target = fs::read_symlink(src, ec).string();
+        if (ec) {
+            LOG_ERROR("erofs: cannot read link " + src.string() + ": " + ec.message());
+            return false;
+        }
+    } else if (S_ISDIR(st.st_mode)) {
+        char buf[16];
+        ssize_t len = lgetxattr(src.c_str(), REPLACE_DIR_XATTR, buf, sizeof(buf));
+        if (len > 0) opaque.assign(buf, len);
+    }
+
+    hasher.add(rel.string());
+    hasher.add((uint64_t)st.st_mode);
+    hasher.add((uint64_t)st.st_uid << 32 | st.st_gid);
+    hasher.add(S_ISDIR(st.st_mode) ? 0 : (uint64_t)st.st_size);
+    hasher.add((uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    hasher.add((uint64_t)st.st_rdev);
+    hasher.add(context);
+    hasher.add(link_target);
+    hasher.add(opaque);
+
+    {
+        Inode& node = tree.inodes[index];
+        node.link_target = link_target;
+        if (!context.empty()) node.xattrs.push_back({XATTR_INDEX_SECURITY, "selinux", context});
+        // "trusted.overlay.opaque" keeps .replace directories working as an overlay lower
+        if (!opaque.empty()) node.xattrs.push_back({XATTR_INDEX_TRUSTED, "overlay.opaque", opaque});
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        std::vector<std::string> names;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(src, ec)) {
+            names.push_back(entry.path().filename().string());
+        }
+        if (ec) {
+            LOG_ERROR("erofs: cannot list " + src.string() + ": " + ec.message());
+            return false;
+        }
+        std::sort(names.begin(), names.end());
+
+        std::vector<std::pair<std::string, uint32_t>> entries;
+        uint32_t subdirs = 0;
+        for (const auto& name : names) {
+            if (name.size() > 255) {
+                LOG_ERROR("erofs: name too long: " + (src / name).string());
+                return false;
+            }
+            struct stat child_st;
+            fs::path child = src / name;
+            if (lstat(child.c_str(), &child_st) != 0) {
+                LOG_ERROR("erofs: cannot stat " + child.string() + ": " + strerror(errno));
+                return false;
+            }
+            uint32_t child_index = 0;
+            if (!scan_node(tree, child, rel / name, child_st, index, label, links, hasher, child_index)) {
+                return false;
+            }
+            if (S_ISDIR(child_st.st_mode)) subdirs++;
+            entries.emplace_back(name, child_index);
+        }
+
+        Inode& node = tree.inodes[index];
+        node.entries = std::move(entries);
+        node.nlink = 2 + subdirs;
+    }
+
+    out_index = index;
+    return true;
+}
+
+bool scan_tree(const fs::path& src, const ErofsLabelFn& label, Tree& tree) {
+    struct stat st;
+    if (lstat(src.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        LOG_ERROR("erofs: source is not a directory: " + src.string());
+        return false;
+    }
+
+    std::map<std::pair<dev_t, ino_t>, uint32_t> links;
+    StampHasher hasher;
+    hasher.add(WRITER_VERSION);
+    uint32_t root = 0;
+    if (!scan_node(tree, src, "/", st, 0, label, links, hasher, root)) {
+        return false;
+    }
+    tree.stamp = hasher.h;
+    return true;
+}
+
+// Full directory listing including "." and "..", in on-disk (byte) order
+std::vector<std::pair<std::string, uint32_t>> dir_listing(const Tree& tree, uint32_t index) {
+    const Inode& node = tree.inodes[index];
+    std::vector<std::pair<std::string, uint32_t>> list = node.entries;
+    list.emplace_back(".", index);
+    list.emplace_back("..", node.parent);
+    std::sort(list.begin(), list.end());
+    return list;
+}
+
+// Split a directory into blocks and return its size in bytes
+uint64_t layout_directory(const Tree& tree, uint32_t index, std::vector<uint32_t>& block_starts) {
+    auto list = dir_listing(tree, index);
+    block_starts.clear();
+
+    uint64_t full_blocks = 0;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < list.size(); ++i) {
+        uint32_t need = DIRENT_SIZE + list[i].first.size();
+        if (block_starts.empty() || used + need > BLOCK_SIZE) {
+            if (!block_starts.empty()) full_blocks++;
+            block_starts.push_back(i);
+            used = 0;
+        }
+        used += need;
+    }
+    return full_blocks * BLOCK_SIZE + used;
+}
+
+std::vector<uint8_t> build_directory(const Tree& tree, uint32_t index) {
+    const Inode& node = tree.inodes[index];
+    auto list = dir_listing(tree, index);
+    std::vector<uint8_t> data(align_up(node.size, BLOCK_SIZE), 0);
+
+    for (size_t b = 0; b < node.dir_block_starts.size(); ++b) {
+        uint32_t first = node.dir_block_starts[b];
+        uint32_t last = b + 1 < node.dir_block_starts.size() ? node.dir_block_starts[b + 1] : list.size();
+        uint8_t* block = data.data() + b * BLOCK_SIZE;
+        uint32_t nameoff = (last - first) * DIRENT_SIZE;
+
+        for (uint32_t i = first; i < last; ++i) {
+            const auto& [name, child] = list[i];
+            uint8_t* de = block + (i - first) * DIRENT_SIZE;
+            put64(de, tree.inodes[child].meta_offset / INODE_SLOT);
+            put16(de + 8, nameoff);
+            de[10] = dirent_type(tree.inodes[child].st.st_mode);
+            memcpy(block + nameoff, name.data(), name.size());
+            nameoff += name.size();
+        }
+    }
+    data.resize(node.size);
+    return data;
+}
+
+uint32_t xattr_ibody_size(const Inode& node) {
+    if (node.xattrs.empty()) return 0;
+    uint32_t size = XATTR_IBODY_HEADER_SIZE;
+    for (const auto& x : node.xattrs) {
+        size += align_up(4 + x.name.size() + x.value.size(), 4);
+    }
+    return size;
+}
+
+// Assign metadata offsets and data blocks; returns the total image size in blocks
+uint64_t layout_tree(Tree& tree, uint64_t& data_bytes) {
+    uint64_t meta_cursor = 0;
+    data_bytes = 0;
+
+    for (uint32_t i = 0; i < tree.inodes.size(); ++i) {
+        Inode& node = tree.inodes[i];
+        mode_t type = node.st.st_mode & S_IFMT;
+
+        if (type == S_IFDIR) {
+            node.size = layout_directory(tree, i, node.dir_block_starts);
+        } else if (type == S_IFREG) {
+            node.size = node.st.st_size;
+        } else if (type == S_IFLNK) {
+            node.size = node.link_target.size();
+        } else {
+            node.size = 0;
+        }
+        data_bytes += node.size;
+
+        node.xattr_size = xattr_ibody_size(node);
+        uint32_t meta = INODE_EXTENDED_SIZE + node.xattr_size;
+        uint32_t tail = node.size % BLOCK_SIZE;
+
+        // Tail-pack the last partial block next to the inode when it fits in one block
+        node.layout = LAYOUT_FLAT_PLAIN;
+        node.inline_size = 0;
+        if (tail > 0 && meta + tail <= BLOCK_SIZE) {
+            node.layout = LAYOUT_FLAT_INLINE;
+            node.inline_size = tail;
+        }
+
+        uint64_t off = align_up(meta_cursor, INODE_SLOT);
+        uint64_t need = meta + node.inline_size;
+        if (off % BLOCK_SIZE + need > BLOCK_SIZE) {
+            off = align_up(off, BLOCK_SIZE);
+        }
+        node.meta_offset = off;
+        meta_cursor = off + need;
+    }
+
+    uint64_t next_block = META_BLKADDR + align_up(meta_cursor, BLOCK_SIZE) / BLOCK_SIZE;
+    for (auto& node : tree.inodes) {
+        uint64_t blocks = node.layout == LAYOUT_FLAT_INLINE ? node.size / BLOCK_SIZE
+                                                            : align_up(node.size, BLOCK_SIZE) / BLOCK_SIZE;
+        node.blkaddr = blocks > 0 ? next_block : 0;
+        next_block += blocks;
+    }
+    return next_block;
+}
+
+void write_inode(const Tree& tree, uint32_t index, uint8_t* p) {
+    const Inode& node = tree.inodes[index];
+    const struct stat& st = node.st;
+
+    put16(p + 0, 1 | (node.layout << 1)); // extended inode
+    put16(p + 2, node.xattr_size ? (node.xattr_size - XATTR_IBODY_HEADER_SIZE) / 4 + 1 : 0);
+    put16(p + 4, st.st_mode);
+    put64(p + 8, node.size);
+    if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+        put32(p + 16, encode_dev(st.st_rdev));
+    } else {
+        put32(p + 16, node.blkaddr);
+    }
+    put32(p + 20, index + 1);
+    put32(p + 24, st.st_uid);
+    put32(p + 28, st.st_gid);
+    put64(p + 32, st.st_mtim.tv_sec);
+    put32(p + 40, st.st_mtim.tv_nsec);
+    put32(p + 44, node.nlink);
+
+    uint8_t* x = p + INODE_EXTENDED_SIZE;
+    if (node.xattr_size) {
+        // Header: name filter 0, no shared xattrs
+        x += XATTR_IBODY_HEADER_SIZE;
+        for (const auto& xa : node.xattrs) {
+            x[0] = xa.name.size();
+            x[1] = xa.index;
+            put16(x + 2, xa.value.size());
+            memcpy(x + 4, xa.name.data(), xa.name.size());
+            memcpy(x + 4 + xa.name.size(), xa.value.data(), xa.value.size());
+            x += align_up(4 + xa.name.size() + xa.value.size(), 4);
+        }
+    }
+}
+
+bool pwrite_all(int fd, const void* buf, size_t len, uint64_t off) {
+    auto* p = static_cast<const uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return true;
+}
+
+bool pread_all(int fd, void* buf, size_t len, uint64_t off) {
+    auto* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return false; // Shrank since the scan
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return true;
+}
+
+// Copy a regular file: whole blocks to its data area, the tail into the metadata buffer
+bool write_file_data(const Inode& node, int out, uint8_t* tail_dst) {
+    int in = open(node.source.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (in < 0) {
+        LOG_ERROR("erofs: cannot open " + node.source.string() + ": " + strerror(errno));
+        return false;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    static thread_local std::vector<uint8_t> buf(1024 * 1024);
+    uint64_t body = node.size - node.inline_size;
+    uint64_t off = 0;
+    bool ok = true;
+    while (ok && off < body) {
+        size_t chunk = std::min<uint64_t>(buf.size(), body - off);
+        ok = pread_all(in, buf.data(), chunk, off) &&
+             pwrite_all(out, buf.data(), chunk, (uint64_t)node.blkaddr * BLOCK_SIZE + off);
+        off += chunk;
+    }
+    if (ok && node.inline_size > 0) {
+        ok = pread_all(in, tail_dst, node.inline_size, body);
+    }
+
+    posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+    close(in);
+    if (!ok) {
+        LOG_ERROR("erofs: failed to copy " + node.source.string() + " (changed during build?)");
+    }
+    return ok;
+}
+
+} // namespace
+
+uint64_t erofs_tree_stamp(const fs::path& src, const ErofsLabelFn& label) {
+    Tree tree;
+    return scan_tree(src, label, tree) ? tree.stamp : 0;
+}
+
+bool read_erofs_stamp(const fs::path& image, uint64_t& stamp) {
+    int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    uint8_t sb[128];
+    bool ok = pread_all(fd, sb, sizeof(sb), EROFS_SUPER_OFFSET);
+    close(fd);
+    if (!ok || get32(sb) != EROFS_MAGIC) {
+        return false;
+    }
+    stamp = get64(sb + 48); // first half of the uuid
+    return true;
+}
+
+bool build_erofs_image(const fs::path& src, const fs::path& image, const ErofsLabelFn& label, ErofsImageInfo* info) {
+    Tree tree;
+    if (!scan_tree(src, label, tree)) {
+        return false;
+    }
+
+    uint64_t data_bytes = 0;
+    uint64_t total_blocks = layout_tree(tree, data_bytes);
+    if (total_blocks > UINT32_MAX) {
+        LOG_ERROR("erofs: image for " + src.string() + " is too large");
+        return false;
+    }
+
+    // Inode and tail area, block 1 onwards; built in memory and written once
+    const Inode& last = tree.inodes.back();
+    std::vector<uint8_t> meta(align_up(last.meta_offset + INODE_EXTENDED_SIZE + last.xattr_size + last.inline_size,
+                                       BLOCK_SIZE), 0);
+
+    fs::path tmp = image;
+    tmp += ".tmp";
+    unlink(tmp.c_str());
+    int out = open(tmp.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out < 0) {
+        LOG_ERROR("erofs: cannot create " + tmp.string() + ": " + strerror(errno));
+        return false;
+    }
+
+    bool ok = ftruncate(out, total_blocks * BLOCK_SIZE) == 0;
+    for (uint32_t i = 0; ok && i < tree.inodes.size(); ++i) {
+        const Inode& node = tree.inodes[i];
+        uint8_t* slot = meta.data() + node.meta_offset;
+        uint8_t* tail = slot + INODE_EXTENDED_SIZE + node.xattr_size;
+        write_inode(tree, i, slot);
+
+        if (S_ISREG(node.st.st_mode)) {
+            if (node.size > 0) ok = write_file_data(node, out, tail);
+            continue;
+        }
+
+        std::vector<uint8_t> data;
+        if (S_ISDIR(node.st.st_mode)) {
+            data = build_directory(tree, i);
+        } else if (S_ISLNK(node.st.st_mode)) {
+            data.assign(node.link_target.begin(), node.link_target.end());
+        }
+        uint64_t body = data.size() - node.inline_size;
+        if (body > 0) {
+            ok = pwrite_all(out, data.data(), body, (uint64_t)node.blkaddr * BLOCK_SIZE);
+        }
+        if (node.inline_size > 0) {
+            memcpy(tail, data.data() + body, node.inline_size);
+        }
+    }
+
+    if (ok) {
+        ok = pwrite_all(out, meta.data(), meta.size(), (uint64_t)META_BLKADDR * BLOCK_SIZE);
+    }
+
+    if (ok) {
+        uint8_t sb[128] = {};
+        put32(sb + 0, EROFS_MAGIC);
+        sb[12] = BLOCK_BITS;
+        put16(sb + 14, 0); // root nid: the root is laid out first
+        put64(sb + 16, tree.inodes.size());
+        put32(sb + 36, total_blocks);
+        put32(sb + 40, META_BLKADDR);
+        put64(sb + 48, tree.stamp);
+        memcpy(sb + 64, "hymo", 4);
+        ok = pwrite_all(out, sb, sizeof(sb), EROFS_SUPER_OFFSET);
+    }
+
+    if (ok) ok = fsync(out) == 0;
+    if (close(out) != 0) ok = false;
+
+    if (!ok || rename(tmp.c_str(), image.c_str()) != 0) {
+        LOG_ERROR("erofs: failed to write " + image.string() + ": " + strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    if (info) {
+        info->inodes = tree.inodes.size();
+        info->blocks = total_blocks;
+        info->data_bytes = data_bytes;
+    }
+    return true;
+}
+
+} // namespace hymo
@@ -0,0 +1,34 @@
+// core/erofs.hpp - In-process EROFS image builder
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <filesystem>
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// SELinux label for a path inside the image, e.g. "/system/bin/foo" ("" = leave unlabeled)
+using ErofsLabelFn = std::function<std::string(const fs::path& rel, mode_t mode)>;
+
+struct ErofsImageInfo {
+    uint64_t inodes = 0;
+    uint64_t blocks = 0;     // 4 KiB blocks in the image
+    uint64_t data_bytes = 0; // file and directory payload
+};
+
+// Fingerprint of everything that ends up in an image of src (names, metadata,
+// sizes, mtimes, labels). Images record it, so an unchanged tree is not rebuilt.
+uint64_t erofs_tree_stamp(const fs::path& src, const ErofsLabelFn& label);
+
+// Write an uncompressed EROFS image of src to image (atomically via a temp file)
+bool build_erofs_image(const fs::path& src, const fs::path& image, const ErofsLabelFn& label,
+                       ErofsImageInfo* info = nullptr);
+
+// Stamp stored in an existing image; false if it is missing or not an EROFS image
+bool read_erofs_stamp(const fs::path& image, uint64_t& stamp);
+
+} // namespace hymo
@@ -0,0 +1,231 @@
+// core/labeler.cpp - Compiled file_contexts labeler implementation
+#include "labeler.hpp"
+#include "../utils.hpp"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <sys/stat.h>
+
+namespace hymo {
+
+// Same load order as libselinux; later files extend earlier ones
+static const char* const FILE_CONTEXTS_PATHS[] = {
+    "/system/etc/selinux/plat_file_contexts",
+    "/system_ext/etc/selinux/system_ext_file_contexts",
+    "/product/etc/selinux/product_file_contexts",
+    "/vendor/etc/selinux/vendor_file_contexts",
+    "/vendor/etc/selinux/nonplat_file_contexts",
+    "/odm/etc/selinux/odm_file_contexts",
+};
+
+static bool is_meta(char c) {
+    switch (c) {
+        case '.': case '^': case '$': case '?': case '*':
+        case '+': case '|': case '[': case '(': case '{':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Literal prefix of a spec, honouring escapes and dropping a char made optional by ?, * or {
+static std::string compute_stem(const std::string& pattern, bool& literal) {
+    std::string stem;
+    literal = true;
+    int depth = 0;
+
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char c = pattern[i];
+        if (c == '(') depth++;
+        else if (c == ')') depth--;
+        else if (c == '|' && depth == 0) {
+            // Top-level alternation: no common prefix
+            literal = false;
+            return "";
+        }
+    }
+
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size()) {
+            char next = pattern[i + 1];
+            if (std::isalnum(static_cast<unsigned char>(next))) {
+                // \d, \w, ... are classes, not literals
+                literal = false;
+                break;
+            }
+            stem += next;
+            ++i;
+            continue;
+        }
+        if (is_meta(c)) {
+            literal = false;
+            if ((c == '?' || c == '*' || c == '{') && !stem.empty()) {
+                stem.pop_back();
+            }
+            break;
+        }
+        stem += c;
+    }
+    return stem;
+}
+
+static mode_t parse_file_type(const std::string& token, bool& ok) {
+    ok = true;
+    if (token == "--") return S_IFREG;
+    if (token == "-d") return S_IFDIR;
+    if (token == "-l") return S_IFLNK;
+    if (token == "-c") return S_IFCHR;
+    if (token == "-b") return S_IFBLK;
+    if (token == "-s") return S_IFSOCK;
+    if (token == "-p") return S_IFIFO;
+    ok = false;
+    return 0;
+}
+
+FileContextLabeler& FileContextLabeler::system() {
+    static FileContextLabeler instance;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        std::vector<fs::path> files(std::begin(FILE_CONTEXTS_PATHS), std::end(FILE_CONTEXTS_PATHS));
+        if (instance.load(files)) {
+            LOG_DEBUG("Loaded " + std::to_string(instance.size()) + " file_contexts specs");
+        } else {
+            LOG_DEBUG("No file_contexts available, falling back to system path contexts");
+        }
+    });
+    return instance;
+}
+
+bool FileContextLabeler::parse_line(const std::string& line) {
+    std::istringstream iss(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (iss >> token) {
+        tokens.push_back(token);
+    }
+    if (tokens.empty() || tokens[0][0] == '#') {
+        return true;
+    }
+
+    Spec spec;
+    spec.pattern = tokens[0];
+    if (tokens.size() == 2) {
+        spec.context = tokens[1];
+    } else if (tokens.size() == 3) {
+        bool ok = false;
+        spec.file_type = parse_file_type(tokens[1], ok);
+        if (!ok) return false;
+        spec.context = tokens[2];
+    } else {
+        return false;
+    }
+
+    if (spec.context == "<<none>>") {
+        spec.context.clear();
+    }
+    spec.stem = compute_stem(spec.pattern, spec.literal);
+    specs_.push_back(std::move(spec));
+    return true;
+}
+
+bool FileContextLabeler::load(const std::vector<fs::path>& files) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    specs_.clear();
+    dir_cache_.clear();
+
+    for (const auto& file : files) {
+        std::ifstream in(file);
+        if (!in.is_open()) continue;
+
+        std::string line;
+        size_t bad = 0;
+        while (std::getline(in, line)) {
+            if (!parse_line(line)) bad++;
+        }
+        if (bad > 0) {
+            LOG_DEBUG("Ignored " + std::to_string(bad) + " malformed lines in " + file.string());
+        }
+    }
+
+    // libselinux moves literal specs behind regex specs so an exact path always wins
+    std::stable_partition(specs_.begin(), specs_.end(), [](const Spec& s) { return !s.literal; });
+    return !specs_.empty();
+}
+
+const std::vector<uint32_t>& FileContextLabeler::candidates_for(const std::string& dir) const {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = dir_cache_.find(dir);
+        if (it != dir_cache_.end()) {
+            return it->second;
+        }
+    }
+
+    // Built outside the lock; regexes are left for matches() to compile
+
+    std::string prefix = dir == "/" ? dir : dir + "/";
+    std::vector<uint32_t> list;
+    for (size_t i = specs_.size(); i-- > 0;) {
+        const Spec& spec = specs_[i];
+        const std::string& stem = spec.stem;
+
+        // A child of dir can only match if one of stem / prefix extends the other
+        bool compatible = stem.size() <= prefix.size()
+            ? prefix.compare(0, stem.size(), stem) == 0
+            : stem.compare(0, prefix.size(), prefix) == 0;
+        if (!compatible) continue;
+
+        list.push_back(static_cast<uint32_t>(i));
+    }
+
+    // Another thread may have cached dir meanwhile; emplace keeps whichever came first
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    return dir_cache_.emplace(dir, std::move(list)).first->second;
+}
+
+const std::regex* FileContextLabeler::compiled(const Spec& spec) {
+    std::call_once(*spec.once, [&spec] {
+        try {
+            spec.regex = std::make_unique<std::regex>(
+                "^(" + spec.pattern + ")$", std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error&) {
+            LOG_DEBUG("Unsupported file_contexts regex: " + spec.pattern);
+        }
+    });
+    return spec.regex.get();
+}
+
+bool FileContextLabeler::matches(const Spec& spec, const std::string& path) const {
+    if (path.compare(0, spec.stem.size(), spec.stem) != 0) {
+        return false;
+    }
+    if (spec.literal) {
+        return path.size() == spec.stem.size();
+    }
+    const std::regex* regex = compiled(spec);
+    return regex && std::regex_match(path, *regex);
+}
+
+std::string FileContextLabeler::lookup(const std::string& path, mode_t mode) const {
+    if (specs_.empty() || path.empty() || path[0] != '/') {
+        return "";
+    }
+
+    auto slash = path.find_last_of('/');
+    std::string dir = slash == 0 ? "/" : path.substr(0, slash);
+    mode_t type = mode & S_IFMT;
+
+    for (uint32_t idx : candidates_for(dir)) {
+        const Spec& spec = specs_[idx];
+        if (spec.file_type != 0 && spec.file_type != type) {
+            continue;
+        }
+        if (matches(spec, path)) {
+            return spec.context;
+        }
+    }
+    return "";
+}
+
+} // namespace hymo
@@ -0,0 +1,60 @@
+// core/labeler.hpp - Compiled file_contexts labeler
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <regex>
+#include <unordered_map>
+#include <filesystem>
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// Computes SELinux contexts from the device's file_contexts instead of
+// stat'ing and lgetxattr'ing the matching path on the live system.
+// Matching follows libselinux: literal specs take precedence over regex
+// specs and, within each group, the last matching spec wins.
+class FileContextLabeler {
+public:
+    // Loaded once from the standard partition file_contexts; empty if none are readable
+    static FileContextLabeler& system();
+
+    bool load(const std::vector<fs::path>& files);
+    bool empty() const { return specs_.empty(); }
+    size_t size() const { return specs_.size(); }
+
+    // Context for an absolute path of the given st_mode, or "" if no spec matches
+    // (or the matching spec is <<none>>). Thread-safe.
+    std::string lookup(const std::string& path, mode_t mode) const;
+
+private:
+    struct Spec {
+        std::string pattern;
+        std::string stem;      // literal prefix every match must start with
+        std::string context;
+        mode_t file_type = 0;  // S_IFMT bits, 0 = any
+        bool literal = false;  // no regex meta characters: plain string compare
+        // Compiled on first use; once guards it so lookups never wait on each other
+        std::unique_ptr<std::once_flag> once = std::make_unique<std::once_flag>();
+        mutable std::unique_ptr<std::regex> regex;
+    };
+
+    bool parse_line(const std::string& line);
+    bool matches(const Spec& spec, const std::string& path) const;
+    static const std::regex* compiled(const Spec& spec);
+    const std::vector<uint32_t>& candidates_for(const std::string& dir) const;
+
+    std::vector<Spec> specs_;
+    // Shared for lookups; exclusive only to load or to add a directory to the cache
+    mutable std::shared_mutex mutex_;
+    // Parent directory -> indices of specs whose stem is compatible with it,
+    // in lookup order (highest precedence first)
+    mutable std::unordered_map<std::string, std::vector<uint32_t>> dir_cache_;
+};
+
+} // namespace hymo
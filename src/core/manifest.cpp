@@ -0,0 +1,306 @@
+// core/manifest.cpp - Per-module incremental sync manifest implementation
+#include "manifest.hpp"
+#include "module_tree.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include "../io_ring.hpp"
+#include "../walker.hpp"
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cinttypes>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hymo {
+
+static constexpr const char* MANIFEST_HEADER = "# hymo-manifest v1";
+// Files per copy_small_files call; bounds the read buffers held at once
+static constexpr size_t SMALL_COPY_BATCH = 32;
+
+fs::path manifest_path(const fs::path& storage_root, const std::string& module_id) {
+    return storage_root / SYNC_MANIFEST_DIR_NAME / (module_id + ".list");
+}
+
+bool load_manifest(const fs::path& file, SyncManifest& manifest) {
+    manifest.clear();
+
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(in, line) || line != MANIFEST_HEADER) {
+        return false;
+    }
+
+    // Format: type mode size mtime_ns hash<TAB>relative_path
+    while (std::getline(in, line)) {
+        auto tab = line.find('\t');
+        if (tab == std::string::npos) {
+            manifest.clear();
+            return false;
+        }
+
+        ManifestEntry e;
+        char type = 0;
+        unsigned int mode = 0;
+        unsigned long long size = 0, hash = 0;
+        long long mtime = 0;
+        if (sscanf(line.c_str(), "%c %o %llu %lld %llx", &type, &mode, &size, &mtime, &hash) != 5) {
+            manifest.clear();
+            return false;
+        }
+        e.type = type;
+        e.mode = mode;
+        e.size = size;
+        e.mtime_ns = mtime;
+        e.hash = hash;
+        manifest[line.substr(tab + 1)] = e;
+    }
+
+    return true;
+}
+
+bool save_manifest(const fs::path& file, const SyncManifest& manifest) {
+    if (!ensure_dir_exists(file.parent_path())) {
+        return false;
+    }
+
+    fs::path tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+
+        out << MANIFEST_HEADER << "\n";
+        char buf[128];
+        for (const auto& [rel, e] : manifest) {
+            snprintf(buf, sizeof(buf), "%c %o %" PRIu64 " %" PRId64 " %" PRIx64 "\t",
+                     e.type, e.mode, e.size, e.mtime_ns, e.hash);
+            out << buf << rel << "\n";
+        }
+
+        if (!out.good()) {
+            return false;
+        }
+    }
+
+    // Atomic replace so an interrupted sync keeps describing the previous state
+    if (rename(tmp.c_str(), file.c_str()) != 0) {
+        LOG_WARN("Failed to commit manifest " + file.string() + ": " + strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool entry_from_stat(const struct stat& st, ManifestEntry& e) {
+    if (S_ISDIR(st.st_mode)) e.type = 'd';
+    else if (S_ISREG(st.st_mode)) e.type = 'f';
+    else if (S_ISLNK(st.st_mode)) e.type = 'l';
+    else if (S_ISCHR(st.st_mode)) e.type = 'c';
+    else if (S_ISBLK(st.st_mode)) e.type = 'b';
+    else if (S_ISFIFO(st.st_mode)) e.type = 'p';
+    else return false; // sockets are never synced
+
+    e.mode = st.st_mode & 07777;
+    e.size = (e.type == 'c' || e.type == 'b') ? (uint64_t)st.st_rdev : (uint64_t)st.st_size;
+    e.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    e.hash = 0;
+    return true;
+}
+
+static bool scan_index(const ModuleTree& tree, bool with_hash, SyncManifest& manifest) {
+    const auto& entries = tree.entries();
+    for (uint32_t i = 0; i < entries.size();) {
+        const TreeEntry& t = entries[i];
+        struct stat st = {};
+        st.st_mode = t.mode;
+        st.st_size = t.size;
+        st.st_rdev = t.rdev;
+        st.st_mtim.tv_sec = t.mtime_ns / 1000000000LL;
+        st.st_mtim.tv_nsec = t.mtime_ns % 1000000000LL;
+        // A file rewritten in place leaves its directory untouched, so a refreshed
+        // tree may still carry the old size and mtime
+        if (!tree.stats_fresh() && !t.is_dir() && lstat((tree.root() / t.rel).c_str(), &st) != 0) {
+            i++;
+            continue;
+        }
+
+        ManifestEntry e;
+        if (!entry_from_stat(st, e)) {
+            i++;
+            continue;
+        }
+        if (t.rel.find('\n') != std::string::npos) {
+            LOG_WARN("Skipping unsyncable path: " + (tree.root() / t.rel).string());
+            i = t.end;
+            continue;
+        }
+        if (with_hash && e.type == 'f' && !hash_file(tree.root() / t.rel, e.hash)) {
+            i++;
+            continue;
+        }
+        manifest[t.rel] = e;
+        i++;
+    }
+    return true;
+}
+
+static bool scan_source(const fs::path& src, bool with_hash, SyncManifest& manifest) {
+    std::error_code ec = walk_tree(src, [&](const WalkEntry& entry) {
+        ManifestEntry e;
+        if (!entry_from_stat(entry.st, e)) {
+            return WalkAction::Continue;
+        }
+        if (entry.rel.find('\n') != std::string::npos) {
+            LOG_WARN("Skipping unsyncable path: " + entry.path().string());
+            return WalkAction::SkipSubtree;
+        }
+        if (with_hash && e.type == 'f' && !hash_file(entry.path(), e.hash)) {
+            return WalkAction::Continue;
+        }
+        manifest[entry.rel] = e;
+        return WalkAction::Continue;
+    });
+    if (ec) {
+        LOG_ERROR("Failed to scan " + src.string() + ": " + ec.message());
+        return false;
+    }
+    return true;
+}
+
+static bool remove_entry(const fs::path& path) {
+    std::error_code ec;
+    fs::remove_all(path, ec);
+    if (ec) {
+        LOG_WARN("Failed to remove " + path.string() + ": " + ec.message());
+        return false;
+    }
+    return true;
+}
+
+bool sync_module_incremental(
+    const fs::path& src,
+    const fs::path& dst,
+    const fs::path& manifest_file,
+    bool verify_hash,
+    SyncStats* stats,
+    const ModuleTree* tree
+) {
+    SyncStats local_stats;
+    SyncStats& st = stats ? *stats : local_stats;
+
+    SyncManifest old_manifest;
+    bool have_manifest = load_manifest(manifest_file, old_manifest);
+
+    std::error_code ec;
+    if (!have_manifest && fs::exists(dst, ec)) {
+        // Unknown tree (older hymod or interrupted first sync): rebuild it
+        LOG_DEBUG("No usable manifest for " + dst.string() + ", doing full resync");
+        if (!remove_entry(dst)) {
+            return false;
+        }
+    }
+
+    SyncManifest new_manifest;
+    bool scanned = tree && tree->complete() ? scan_index(*tree, verify_hash, new_manifest)
+                                            : scan_source(src, verify_hash, new_manifest);
+    if (!scanned) {
+        return false;
+    }
+
+    if (!ensure_dir_exists(dst)) {
+        return false;
+    }
+    if (!have_manifest) {
+        struct stat root_st;
+        if (stat(src.c_str(), &root_st) == 0) {
+            chmod(dst.c_str(), root_st.st_mode & 07777);
+        }
+        lsetfilecon(dst, DEFAULT_SELINUX_CONTEXT);
+    }
+
+    bool ok = true;
+
+    // 1. Deletions, children before parents
+    for (auto it = old_manifest.rbegin(); it != old_manifest.rend(); ++it) {
+        auto found = new_manifest.find(it->first);
+        if (found == new_manifest.end() || found->second.type != it->second.type) {
+            if (remove_entry(dst / it->first)) {
+                st.removed++;
+            } else {
+                ok = false;
+            }
+        }
+    }
+
+    // 2. Additions and updates, parents before children. With a ring, small regular
+    // files are collected and copied in batches once their directories exist.
+    IoRing* ring = IoRing::for_thread();
+    std::vector<SmallCopy> small;
+
+    for (const auto& [rel, e] : new_manifest) {
+        fs::path dst_path = dst / rel;
+        auto old = old_manifest.find(rel);
+        bool existed = (old != old_manifest.end() && old->second.type == e.type);
+
+        if (existed && old->second == e) {
+            st.unchanged++;
+            continue;
+        }
+
+        if (e.type == 'd') {
+            if (!existed) {
+                if (mkdir(dst_path.c_str(), e.mode) != 0 && errno != EEXIST) {
+                    LOG_ERROR("Failed to create " + dst_path.string() + ": " + strerror(errno));
+                    ok = false;
+                    continue;
+                }
+                lsetfilecon(dst_path, DEFAULT_SELINUX_CONTEXT);
+            }
+            chmod(dst_path.c_str(), e.mode);
+        } else if (ring && e.type == 'f' && e.size <= IoRing::SMALL_FILE_MAX) {
+            small.push_back(SmallCopy{src / rel, dst_path, (mode_t)e.mode, e.size});
+            continue;
+        } else if (!sync_file(src / rel, dst_path)) {
+            ok = false;
+            continue;
+        }
+
+        st.copied++;
+        st.changed.push_back(dst_path);
+    }
+
+    for (size_t base = 0; base < small.size(); base += SMALL_COPY_BATCH) {
+        std::vector<SmallCopy> batch(small.begin() + base,
+                                     small.begin() + std::min(small.size(), base + SMALL_COPY_BATCH));
+        std::vector<int> errs;
+        ring->copy_small_files(batch, errs);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            // Anything the ring could not do goes through the regular path (and its logging)
+            if (errs[i] != 0 && !sync_file(batch[i].src, batch[i].dst)) {
+                ok = false;
+                continue;
+            }
+            st.copied++;
+            st.changed.push_back(batch[i].dst);
+        }
+    }
+
+    if (!ok) {
+        // Leave the old manifest in place; entries we failed on still differ from it
+        return false;
+    }
+
+    if (!save_manifest(manifest_file, new_manifest)) {
+        LOG_WARN("Failed to save sync manifest for " + dst.string());
+    }
+    return true;
+}
+
+} // namespace hymo
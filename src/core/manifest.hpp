@@ -0,0 +1,57 @@
+// core/manifest.hpp - Per-module incremental sync manifest
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// Source-side metadata of one synced entry, keyed by path relative to the module root
+struct ManifestEntry {
+    char type = 'f';      // 'd' dir, 'f' file, 'l' symlink, 'c'/'b' device node, 'p' fifo
+    uint32_t mode = 0;
+    uint64_t size = 0;    // rdev for device nodes
+    int64_t mtime_ns = 0;
+    uint64_t hash = 0;    // content hash, only recorded when hashing is enabled
+
+    bool operator==(const ManifestEntry& o) const {
+        return type == o.type && mode == o.mode && size == o.size &&
+               mtime_ns == o.mtime_ns && hash == o.hash;
+    }
+    bool operator!=(const ManifestEntry& o) const { return !(*this == o); }
+};
+
+// Ordered so that every directory sorts before its children
+using SyncManifest = std::map<std::string, ManifestEntry>;
+
+struct SyncStats {
+    size_t copied = 0;
+    size_t removed = 0;
+    size_t unchanged = 0;
+    std::vector<fs::path> changed; // dst paths created or rewritten
+};
+
+fs::path manifest_path(const fs::path& storage_root, const std::string& module_id);
+bool load_manifest(const fs::path& file, SyncManifest& manifest);
+bool save_manifest(const fs::path& file, const SyncManifest& manifest);
+
+class ModuleTree;
+
+// Bring dst in line with src, touching only entries added, changed or removed since the
+// manifest was written. Without a manifest an existing dst is rebuilt from scratch.
+// tree, if given, is an index of src and saves walking it again.
+bool sync_module_incremental(
+    const fs::path& src,
+    const fs::path& dst,
+    const fs::path& manifest_file,
+    bool verify_hash,
+    SyncStats* stats = nullptr,
+    const ModuleTree* tree = nullptr
+);
+
+} // namespace hymo
@@ -0,0 +1,620 @@
+// core/module_tree.cpp - Per-run in-memory index of module trees implementation
+#include "module_tree.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include "../walker.hpp"
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+
+namespace hymo {
+
+// On-disk index: header, module records, entry records, string table. All records
+// are fixed size and 8-byte aligned so the file can be used straight from a mapping.
+static constexpr char INDEX_MAGIC[8] = {'H', 'Y', 'M', 'O', 'I', 'D', 'X', '1'};
+static constexpr uint32_t INDEX_VERSION = 1;
+
+struct SavedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t module_count;
+    uint64_t entry_count;
+    uint64_t modules_off;
+    uint64_t entries_off;
+    uint64_t strings_off;
+    uint64_t strings_size;
+};
+
+struct SavedModule {
+    uint32_t id_off, id_len;
+    uint32_t root_off, root_len;
+    uint64_t first_entry;
+    uint32_t entry_count;
+    uint32_t reserved;
+    uint64_t root_dev, root_ino;
+    int64_t root_mtime_ns, root_ctime_ns;
+};
+
+struct SavedEntry {
+    uint32_t rel_off, rel_len;
+    uint32_t mode;
+    uint32_t end; // relative to the module's first entry
+    uint64_t size, rdev;
+    int64_t mtime_ns, ctime_ns;
+    uint8_t flags;
+    uint8_t reserved[7];
+};
+
+static_assert(sizeof(SavedHeader) == 56 && sizeof(SavedModule) == 64 && sizeof(SavedEntry) == 56,
+              "index records must keep their on-disk size");
+
+// One module's records inside the mapped index
+struct SavedTree {
+    const SavedEntry* entries = nullptr;
+    uint32_t count = 0;
+    const char* strings = nullptr;
+    const SavedModule* module = nullptr;
+
+    TreeEntry entry(uint32_t i) const {
+        const SavedEntry& s = entries[i];
+        TreeEntry e;
+        e.rel.assign(strings + s.rel_off, s.rel_len);
+        e.mode = s.mode;
+        e.size = s.size;
+        e.rdev = s.rdev;
+        e.mtime_ns = s.mtime_ns;
+        e.ctime_ns = s.ctime_ns;
+        e.flags = s.flags & (TreeEntry::WHITEOUT | TreeEntry::OPAQUE);
+        return e;
+    }
+    std::string name(uint32_t i) const {
+        std::string rel(strings + entries[i].rel_off, entries[i].rel_len);
+        auto slash = rel.rfind('/');
+        return slash == std::string::npos ? rel : rel.substr(slash + 1);
+    }
+};
+
+static int64_t to_ns(const struct timespec& ts) {
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fill_from_stat(TreeEntry& e, const struct stat& st) {
+    e.mode = st.st_mode;
+    e.size = st.st_size;
+    e.rdev = st.st_rdev;
+    e.mtime_ns = to_ns(st.st_mtim);
+    e.ctime_ns = to_ns(st.st_ctim);
+    e.flags = 0;
+    if (S_ISCHR(st.st_mode) && st.st_rdev == 0) {
+        e.flags |= TreeEntry::WHITEOUT;
+    }
+}
+
+static bool has_opaque_xattr(const fs::path& dir) {
+    char buf[4];
+    ssize_t len = lgetxattr(dir.c_str(), REPLACE_DIR_XATTR, buf, sizeof(buf));
+    return len > 0 && buf[0] == 'y';
+}
+
+const char* TreeEntry::name() const {
+    auto slash = rel.rfind('/');
+    return rel.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+std::error_code ModuleTree::build(const fs::path& root) {
+    root_ = root;
+    entries_.clear();
+    complete_ = false;
+    dirs_read_ = 1;
+    stats_fresh_ = true;
+
+    struct stat root_st;
+    if (stat(root.c_str(), &root_st) != 0) {
+        return std::error_code(errno, std::generic_category());
+    }
+    root_dev = root_st.st_dev;
+    root_ino = root_st.st_ino;
+    root_mtime_ns = to_ns(root_st.st_mtim);
+    root_ctime_ns = to_ns(root_st.st_ctim);
+
+    // Directories on the path to the current entry, outermost first
+    std::vector<uint32_t> open_dirs;
+    auto close_to = [&](size_t depth) {
+        while (open_dirs.size() > depth) {
+            entries_[open_dirs.back()].end = entries_.size();
+            open_dirs.pop_back();
+        }
+    };
+
+    std::error_code ec = walk_tree(root, [&](const WalkEntry& w) {
+        close_to(std::count(w.rel.begin(), w.rel.end(), '/'));
+
+        TreeEntry e;
+        e.rel = w.rel;
+        fill_from_stat(e, w.st);
+        e.end = entries_.size() + 1;
+        if (S_ISDIR(w.st.st_mode)) {
+            if (has_opaque_xattr(w.path())) e.flags |= TreeEntry::OPAQUE;
+            open_dirs.push_back(entries_.size());
+            dirs_read_++;
+        }
+        entries_.push_back(std::move(e));
+        return WalkAction::Continue;
+    });
+    close_to(0);
+
+    finish();
+    complete_ = !ec;
+    return ec;
+}
+
+std::error_code ModuleTree::refresh(const fs::path& root, const SavedTree& saved) {
+    struct stat st;
+    if (stat(root.c_str(), &st) != 0) {
+        return std::error_code(errno, std::generic_category());
+    }
+    if (st.st_dev != saved.module->root_dev || st.st_ino != saved.module->root_ino) {
+        // Module directory was replaced (e.g. by a module update)
+        return build(root);
+    }
+
+    root_ = root;
+    entries_.clear();
+    complete_ = false;
+    dirs_read_ = 0;
+    stats_fresh_ = false;
+    root_dev = st.st_dev;
+    root_ino = st.st_ino;
+    root_mtime_ns = to_ns(st.st_mtim);
+    root_ctime_ns = to_ns(st.st_ctim);
+
+    bool changed = root_mtime_ns != saved.module->root_mtime_ns || root_ctime_ns != saved.module->root_ctime_ns;
+    std::error_code ec = refresh_dir("", saved, 0, saved.count, changed);
+    if (ec) {
+        entries_.clear();
+        return ec;
+    }
+    finish();
+    complete_ = true;
+    return {};
+}
+
+// Append the entries below directory rel; saved entries [begin, end) are its subtree
+// from the saved index (empty for a directory that is new)
+std::error_code ModuleTree::refresh_dir(const std::string& rel, const SavedTree& saved,
+                                        uint32_t begin, uint32_t end, bool changed) {
+    if (!changed) {
+        // Same listing as last time; only subdirectories need looking at
+        for (uint32_t i = begin; i < end; i = saved.entries[i].end) {
+            const SavedEntry& s = saved.entries[i];
+            TreeEntry e = saved.entry(i);
+            uint32_t index = entries_.size();
+            if (!e.is_dir()) {
+                e.end = index + 1;
+                entries_.push_back(std::move(e));
+                continue;
+            }
+
+            struct stat st;
+            fs::path dir = root_ / e.rel;
+            if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+                // Parent claims nothing changed, yet this is gone: don't trust the saved data
+                return std::error_code(ESTALE, std::generic_category());
+            }
+            bool child_changed = to_ns(st.st_mtim) != s.mtime_ns || to_ns(st.st_ctim) != s.ctime_ns;
+            fill_from_stat(e, st);
+            if (child_changed ? has_opaque_xattr(dir) : (s.flags & TreeEntry::OPAQUE)) {
+                e.flags |= TreeEntry::OPAQUE;
+            }
+
+            std::string child_rel = e.rel;
+            entries_.push_back(std::move(e));
+            if (auto ec = refresh_dir(child_rel, saved, i + 1, s.end, child_changed)) {
+                return ec;
+            }
+            entries_[index].end = entries_.size();
+        }
+        return {};
+    }
+
+    // Listing changed: read it again, reusing saved subtrees of subdirectories that still exist
+    dirs_read_++;
+    std::unordered_map<std::string, uint32_t> saved_dirs;
+    for (uint32_t i = begin; i < end; i = saved.entries[i].end) {
+        if (S_ISDIR(saved.entries[i].mode)) saved_dirs.emplace(saved.name(i), i);
+    }
+
+    struct Child {
+        std::string name;
+        struct stat st;
+    };
+    std::vector<Child> children;
+    fs::path dir = rel.empty() ? root_ : root_ / rel;
+    std::error_code ec = walk_tree(dir, [&](const WalkEntry& w) {
+        children.push_back(Child{w.name, w.st});
+        return WalkAction::SkipSubtree;
+    });
+    if (ec) return ec;
+
+    for (const auto& child : children) {
+        TreeEntry e;
+        e.rel = rel.empty() ? child.name : rel + "/" + child.name;
+        fill_from_stat(e, child.st);
+        uint32_t index = entries_.size();
+        e.end = index + 1;
+        if (!S_ISDIR(child.st.st_mode)) {
+            entries_.push_back(std::move(e));
+            continue;
+        }
+
+        if (has_opaque_xattr(root_ / e.rel)) e.flags |= TreeEntry::OPAQUE;
+        std::string child_rel = e.rel;
+        entries_.push_back(std::move(e));
+
+        auto it = saved_dirs.find(child.name);
+        if (it != saved_dirs.end()) {
+            const SavedEntry& s = saved.entries[it->second];
+            bool child_changed = to_ns(child.st.st_mtim) != s.mtime_ns || to_ns(child.st.st_ctim) != s.ctime_ns;
+            ec = refresh_dir(child_rel, saved, it->second + 1, s.end, child_changed);
+        } else {
+            ec = refresh_dir(child_rel, saved, 0, 0, true);
+        }
+        if (ec) return ec;
+        entries_[index].end = entries_.size();
+    }
+    return {};
+}
+
+// Derive the flags that depend on descendants
+void ModuleTree::finish() {
+    std::vector<uint32_t> open_dirs;
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+        while (!open_dirs.empty() && entries_[open_dirs.back()].end <= i) {
+            open_dirs.pop_back();
+        }
+
+        TreeEntry& e = entries_[i];
+        e.flags &= ~(TreeEntry::REPLACE | TreeEntry::HAS_FILES);
+        if (e.flags & TreeEntry::OPAQUE) {
+            e.flags |= TreeEntry::REPLACE;
+        }
+        if (!e.is_dir() && !open_dirs.empty() && strcmp(e.name(), REPLACE_DIR_FILE_NAME) == 0) {
+            entries_[open_dirs.back()].flags |= TreeEntry::REPLACE;
+        }
+        if (S_ISREG(e.mode) || S_ISLNK(e.mode)) {
+            // Mark ancestors up to the first one that already knows
+            for (auto it = open_dirs.rbegin(); it != open_dirs.rend(); ++it) {
+                uint8_t& flags = entries_[*it].flags;
+                if (flags & TreeEntry::HAS_FILES) break;
+                flags |= TreeEntry::HAS_FILES;
+            }
+        }
+        if (e.is_dir()) {
+            open_dirs.push_back(i);
+        }
+    }
+}
+
+long ModuleTree::find(const std::string& rel) const {
+    if (rel.empty()) return -1;
+
+    uint32_t begin = 0;
+    uint32_t end = entries_.size();
+    size_t pos = 0;
+    while (begin < end) {
+        auto slash = rel.find('/', pos);
+        size_t prefix_len = slash == std::string::npos ? rel.size() : slash;
+
+        // Step through siblings, jumping over their subtrees
+        uint32_t i = begin;
+        while (i < end) {
+            const std::string& cand = entries_[i].rel;
+            if (cand.size() == prefix_len && rel.compare(0, prefix_len, cand) == 0) break;
+            i = entries_[i].end;
+        }
+        if (i >= end) return -1;
+        if (slash == std::string::npos) return i;
+
+        begin = i + 1;
+        end = entries_[i].end;
+        pos = slash + 1;
+    }
+    return -1;
+}
+
+std::pair<uint32_t, uint32_t> ModuleTree::subtree(const std::string& rel) const {
+    if (rel.empty()) {
+        return {0, (uint32_t)entries_.size()};
+    }
+    long i = find(rel);
+    if (i < 0 || !entries_[i].is_dir()) {
+        return {0, 0};
+    }
+    return {(uint32_t)i + 1, entries_[i].end};
+}
+
+bool ModuleTree::has_files(const std::string& rel) const {
+    if (!complete_) {
+        return has_files_recursive(rel.empty() ? root_ : root_ / rel);
+    }
+    if (rel.empty()) {
+        return std::any_of(entries_.begin(), entries_.end(), [](const TreeEntry& e) {
+            return (e.mode & S_IFMT) == S_IFREG || (e.mode & S_IFMT) == S_IFLNK;
+        });
+    }
+    long i = find(rel);
+    return i >= 0 && entries_[i].is_dir() && (entries_[i].flags & TreeEntry::HAS_FILES);
+}
+
+ModuleIndex& ModuleIndex::global() {
+    static ModuleIndex instance;
+    return instance;
+}
+
+ModuleIndex::~ModuleIndex() {
+    unmap();
+}
+
+static std::string normalize(const fs::path& path) {
+    std::string s = path.lexically_normal().string();
+    while (s.size() > 1 && s.back() == '/') s.pop_back();
+    return s;
+}
+
+const ModuleTree& ModuleIndex::get(const std::string& id, const fs::path& source) {
+    SavedTree saved;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = trees_.find(id);
+        if (it != trees_.end()) return *it->second;
+
+        auto rec = saved_modules_.find(id);
+        if (rec != saved_modules_.end()) {
+            const auto* hdr = reinterpret_cast<const SavedHeader*>(map_);
+            const auto* mod = reinterpret_cast<const SavedModule*>(map_ + hdr->modules_off) + rec->second;
+            const char* strings = reinterpret_cast<const char*>(map_ + hdr->strings_off);
+            if (std::string(strings + mod->root_off, mod->root_len) == normalize(source)) {
+                saved.module = mod;
+                saved.entries = reinterpret_cast<const SavedEntry*>(map_ + hdr->entries_off) + mod->first_entry;
+                saved.count = mod->entry_count;
+                saved.strings = strings;
+            }
+        }
+    }
+
+    // Walk outside the lock; sync workers index different modules in parallel
+    auto tree = std::make_unique<ModuleTree>();
+    std::error_code ec;
+    bool refreshed = false;
+    if (saved.module) {
+        ec = tree->refresh(source, saved);
+        refreshed = !ec;
+        if (ec) {
+            LOG_DEBUG("Module index: saved tree of " + id + " unusable (" + ec.message() + "), rescanning");
+        }
+    }
+    if (!refreshed) {
+        ec = tree->build(source);
+    }
+    if (ec && ec != std::errc::no_such_file_or_directory) {
+        LOG_WARN("Module index: walk of " + source.string() + " failed: " + ec.message());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto [it, inserted] = trees_.emplace(id, std::move(tree));
+    if (inserted) {
+        aliases_[normalize(source)] = Alias{id, ""};
+        LOG_DEBUG("Module index: " + id + " has " + std::to_string(it->second->entries().size()) + " entries (" +
+                  std::to_string(it->second->dirs_read()) + " directories read" + (refreshed ? ", refreshed)" : ")"));
+    }
+    return *it->second;
+}
+
+const ModuleTree* ModuleIndex::find(const std::string& id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = trees_.find(id);
+    return it == trees_.end() ? nullptr : it->second.get();
+}
+
+void ModuleIndex::alias(const fs::path& dir, const fs::path& original) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string rel;
+    const ModuleTree* tree = resolve_locked(normalize(original), rel);
+    if (!tree) return;
+
+    for (const auto& [id, t] : trees_) {
+        if (t.get() == tree) {
+            aliases_[normalize(dir)] = Alias{id, rel};
+            return;
+        }
+    }
+}
+
+const ModuleTree* ModuleIndex::resolve(const fs::path& path, std::string& rel) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resolve_locked(normalize(path), rel);
+}
+
+const ModuleTree* ModuleIndex::resolve_locked(const std::string& path, std::string& rel) const {
+    // Longest registered directory that is path or one of its ancestors
+    std::string dir = path;
+    while (!dir.empty()) {
+        auto it = aliases_.find(dir);
+        if (it != aliases_.end()) {
+            auto tree = trees_.find(it->second.id);
+            if (tree == trees_.end()) return nullptr;
+
+            std::string rest = dir.size() < path.size() ? path.substr(dir.size() + 1) : "";
+            rel = it->second.rel;
+            if (!rest.empty()) rel = rel.empty() ? rest : rel + "/" + rest;
+            return tree->second.get();
+        }
+        auto slash = dir.rfind('/');
+        if (slash == std::string::npos || slash == 0) break;
+        dir.resize(slash);
+    }
+    return nullptr;
+}
+
+// Bounds-check every record so a truncated or corrupt file is rejected up front
+static bool validate_index(const uint8_t* base, size_t size) {
+    if (size < sizeof(SavedHeader)) return false;
+    const auto* hdr = reinterpret_cast<const SavedHeader*>(base);
+    if (memcmp(hdr->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || hdr->version != INDEX_VERSION) {
+        return false;
+    }
+
+    auto table_fits = [&](uint64_t off, uint64_t count, uint64_t rec) {
+        return off % 8 == 0 && off <= size && count <= (size - off) / rec;
+    };
+    if (!table_fits(hdr->modules_off, hdr->module_count, sizeof(SavedModule)) ||
+        !table_fits(hdr->entries_off, hdr->entry_count, sizeof(SavedEntry)) ||
+        hdr->strings_off > size || hdr->strings_size > size - hdr->strings_off) {
+        return false;
+    }
+    auto string_fits = [&](uint32_t off, uint32_t len) {
+        return (uint64_t)off + len <= hdr->strings_size;
+    };
+
+    const auto* mods = reinterpret_cast<const SavedModule*>(base + hdr->modules_off);
+    const auto* ents = reinterpret_cast<const SavedEntry*>(base + hdr->entries_off);
+    for (uint32_t m = 0; m < hdr->module_count; ++m) {
+        const SavedModule& mod = mods[m];
+        if (!string_fits(mod.id_off, mod.id_len) || !string_fits(mod.root_off, mod.root_len) ||
+            mod.first_entry > hdr->entry_count || mod.entry_count > hdr->entry_count - mod.first_entry) {
+            return false;
+        }
+        for (uint32_t i = 0; i < mod.entry_count; ++i) {
+            const SavedEntry& e = ents[mod.first_entry + i];
+            if (!string_fits(e.rel_off, e.rel_len) || e.end <= i || e.end > mod.entry_count) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool ModuleIndex::load(const fs::path& file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unmap();
+
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    map_ = static_cast<const uint8_t*>(map);
+    map_size_ = st.st_size;
+    if (!validate_index(map_, map_size_)) {
+        LOG_WARN("Ignoring invalid module index " + file.string());
+        unmap();
+        return false;
+    }
+
+    const auto* hdr = reinterpret_cast<const SavedHeader*>(map_);
+    const auto* mods = reinterpret_cast<const SavedModule*>(map_ + hdr->modules_off);
+    const char* strings = reinterpret_cast<const char*>(map_ + hdr->strings_off);
+    for (uint32_t m = 0; m < hdr->module_count; ++m) {
+        saved_modules_[std::string(strings + mods[m].id_off, mods[m].id_len)] = m;
+    }
+    LOG_DEBUG("Loaded module index: " + std::to_string(hdr->module_count) + " modules, " +
+              std::to_string(hdr->entry_count) + " entries");
+    return true;
+}
+
+bool ModuleIndex::save(const fs::path& file) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::string strings;
+    auto add_string = [&](const std::string& s, uint32_t& off, uint32_t& len) {
+        off = strings.size();
+        len = s.size();
+        strings += s;
+    };
+
+    std::vector<SavedModule> mods;
+    std::vector<SavedEntry> ents;
+    for (const auto& [id, tree] : trees_) {
+        if (!tree->complete()) continue;
+
+        SavedModule mod = {};
+        add_string(id, mod.id_off, mod.id_len);
+        add_string(normalize(tree->root()), mod.root_off, mod.root_len);
+        mod.first_entry = ents.size();
+        mod.entry_count = tree->entries().size();
+        mod.root_dev = tree->root_dev;
+        mod.root_ino = tree->root_ino;
+        mod.root_mtime_ns = tree->root_mtime_ns;
+        mod.root_ctime_ns = tree->root_ctime_ns;
+        mods.push_back(mod);
+
+        for (const auto& e : tree->entries()) {
+            SavedEntry s = {};
+            add_string(e.rel, s.rel_off, s.rel_len);
+            s.mode = e.mode;
+            s.end = e.end;
+            s.size = e.size;
+            s.rdev = e.rdev;
+            s.mtime_ns = e.mtime_ns;
+            s.ctime_ns = e.ctime_ns;
+            s.flags = e.flags;
+            ents.push_back(s);
+        }
+    }
+
+    SavedHeader hdr = {};
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    hdr.version = INDEX_VERSION;
+    hdr.module_count = mods.size();
+    hdr.entry_count = ents.size();
+    hdr.modules_off = sizeof(SavedHeader);
+    hdr.entries_off = hdr.modules_off + mods.size() * sizeof(SavedModule);
+    hdr.strings_off = hdr.entries_off + ents.size() * sizeof(SavedEntry);
+    hdr.strings_size = strings.size();
+
+    std::string data;
+    data.reserve(sizeof(hdr) + mods.size() * sizeof(SavedModule) + ents.size() * sizeof(SavedEntry) + strings.size());
+    data.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    data.append(reinterpret_cast<const char*>(mods.data()), mods.size() * sizeof(SavedModule));
+    data.append(reinterpret_cast<const char*>(ents.data()), ents.size() * sizeof(SavedEntry));
+    data.append(strings);
+    return write_file_atomic(file, data);
+}
+
+void ModuleIndex::unmap() {
+    if (map_) {
+        munmap(const_cast<uint8_t*>(map_), map_size_);
+    }
+    map_ = nullptr;
+    map_size_ = 0;
+    saved_modules_.clear();
+}
+
+void ModuleIndex::forget(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trees_.erase(id);
+    saved_modules_.erase(id);
+}
+
+void ModuleIndex::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trees_.clear();
+    aliases_.clear();
+    unmap();
+}
+
+} // namespace hymo
@@ -0,0 +1,131 @@
+// core/module_tree.hpp - Per-run in-memory index of module trees
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+struct TreeEntry {
+    static constexpr uint8_t WHITEOUT = 1;  // 0:0 character device
+    static constexpr uint8_t REPLACE = 2;   // directory with .replace or the opaque xattr
+    static constexpr uint8_t HAS_FILES = 4; // directory with a file or symlink somewhere below
+    static constexpr uint8_t OPAQUE = 8;    // directory carrying the opaque xattr itself
+
+    std::string rel;       // relative to the module root, "system/bin/sh"
+    uint32_t mode = 0;     // st_mode
+    uint64_t size = 0;
+    uint64_t rdev = 0;
+    int64_t mtime_ns = 0;
+    int64_t ctime_ns = 0;
+    uint32_t end = 0;      // index one past the last descendant
+    uint8_t flags = 0;
+
+    bool is_dir() const { return (mode & S_IFMT) == S_IFDIR; }
+    const char* name() const;
+};
+
+struct SavedTree;
+
+// Everything below one module root, from a single walk. Entries are in pre-order,
+// so the descendants of entry i are exactly [i + 1, entries[i].end).
+class ModuleTree {
+public:
+    std::error_code build(const fs::path& root);
+    // Rebuild from a tree saved on an earlier run: directories whose mtime and ctime
+    // are unchanged keep their saved listing, the others are read again. A file
+    // rewritten in place changes neither, so this must only back trees that are
+    // allowed to miss such edits until the next full build.
+    std::error_code refresh(const fs::path& root, const SavedTree& saved);
+
+    const fs::path& root() const { return root_; }
+    const std::vector<TreeEntry>& entries() const { return entries_; }
+    // False if the walk failed part way; queries then fall back to the filesystem
+    bool complete() const { return complete_; }
+    // Directories listed from disk by the last build or refresh
+    size_t dirs_read() const { return dirs_read_; }
+    // False after a refresh that reused saved listings: sizes and times of files in
+    // those directories are from the earlier run and must be re-read before use
+    bool stats_fresh() const { return stats_fresh_; }
+
+    // Index of rel ("" is not an entry), or -1
+    long find(const std::string& rel) const;
+    // Entry indices strictly below rel ("" = the whole tree); empty if rel is not a directory
+    std::pair<uint32_t, uint32_t> subtree(const std::string& rel) const;
+    // Same answer as has_files_recursive(root / rel)
+    bool has_files(const std::string& rel) const;
+
+    // Identity and times of the root directory itself
+    uint64_t root_dev = 0;
+    uint64_t root_ino = 0;
+    int64_t root_mtime_ns = 0;
+    int64_t root_ctime_ns = 0;
+
+private:
+    std::error_code refresh_dir(const std::string& rel, const SavedTree& saved,
+                                uint32_t begin, uint32_t end, bool changed);
+    void finish();
+
+    fs::path root_;
+    std::vector<TreeEntry> entries_;
+    bool complete_ = false;
+    size_t dirs_read_ = 0;
+    bool stats_fresh_ = true;
+};
+
+// Module trees for the current run, keyed by module id. Storage, mirror and staging
+// copies of a module can be registered as aliases so that code handed a path
+// instead of a module finds the same tree. Thread-safe.
+class ModuleIndex {
+public:
+    static ModuleIndex& global();
+    ~ModuleIndex();
+
+    // Tree of the module's source, walked (or refreshed from the loaded index) on first use
+    const ModuleTree& get(const std::string& id, const fs::path& source);
+    // Tree registered for id, or nullptr
+    const ModuleTree* find(const std::string& id) const;
+
+    // dir holds the same content as original (a module source or an existing alias)
+    void alias(const fs::path& dir, const fs::path& original);
+    // Tree and relative path ("" for the root) for a path inside a module source or alias
+    const ModuleTree* resolve(const fs::path& path, std::string& rel) const;
+
+    // Map an index written by save() on an earlier run; later get() calls refresh from it
+    bool load(const fs::path& file);
+    // Write every complete tree of this run (atomically via a temp file)
+    bool save(const fs::path& file) const;
+
+    // Drop the tree of id and its saved record, so the next get() walks it afresh
+    void forget(const std::string& id);
+    void clear();
+
+private:
+    struct Alias {
+        std::string id;
+        std::string rel;
+    };
+
+    const ModuleTree* resolve_locked(const std::string& path, std::string& rel) const;
+    void unmap();
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<ModuleTree>> trees_;
+    std::map<std::string, Alias> aliases_; // normalized dir -> module id and subtree
+
+    // Loaded index file, mapped read-only
+    const uint8_t* map_ = nullptr;
+    size_t map_size_ = 0;
+    std::map<std::string, uint32_t> saved_modules_; // module id -> record number
+};
+
+} // namespace hymo
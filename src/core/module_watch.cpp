@@ -0,0 +1,151 @@
+// core/module_watch.cpp - inotify watch on modules and hymo configuration implementation
+#include "module_watch.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+namespace hymo {
+
+static constexpr uint32_t ENTRY_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+static constexpr uint32_t FILE_EVENTS = ENTRY_EVENTS | IN_CLOSE_WRITE | IN_ATTRIB;
+
+// Entries of the module directory that are modules (hymo itself is never mounted)
+static bool is_module_name(const std::string& name) {
+    return !name.empty() && name[0] != '.' && name != "hymo";
+}
+
+// Files in BASE_DIR that feed the plan besides the config file
+static bool is_config_name(const std::string& name) {
+    return name == "config.toml" || name == "module_mode.conf" || name == "module_rules.conf";
+}
+
+ModuleWatcher::ModuleWatcher(const fs::path& moduledir, const fs::path& config_file)
+    : moduledir_(moduledir), config_file_(config_file) {}
+
+ModuleWatcher::~ModuleWatcher() {
+    if (fd_ >= 0) close(fd_);
+}
+
+int ModuleWatcher::add_watch(const fs::path& dir, uint32_t mask) {
+    int wd = inotify_add_watch(fd_, dir.c_str(), mask | IN_ONLYDIR);
+    if (wd < 0) {
+        LOG_WARN("Cannot watch " + dir.string() + ": " + strerror(errno));
+    }
+    return wd;
+}
+
+void ModuleWatcher::watch_module(const std::string& id) {
+    std::error_code ec;
+    if (!is_module_name(id) || !fs::is_directory(moduledir_ / id, ec)) return;
+    int wd = add_watch(moduledir_ / id, FILE_EVENTS);
+    if (wd >= 0) module_wds_[wd] = id;
+}
+
+bool ModuleWatcher::start() {
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) {
+        LOG_ERROR("inotify_init1 failed: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    moduledir_wd_ = add_watch(moduledir_, ENTRY_EVENTS);
+    if (moduledir_wd_ < 0) return false;
+    // Editors and the WebUI write config files in place or rename a temp file over them
+    base_wd_ = add_watch(BASE_DIR, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+    config_wd_ = add_watch(config_file_.parent_path(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+    if (ensure_dir_exists(HOT_UNMOUNTED_DIR)) {
+        hot_unmount_wd_ = add_watch(HOT_UNMOUNTED_DIR, ENTRY_EVENTS);
+    }
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(moduledir_, ec)) {
+        watch_module(entry.path().filename().string());
+    }
+    LOG_INFO("Watching " + moduledir_.string() + " (" + std::to_string(module_wds_.size()) + " modules)");
+    return true;
+}
+
+bool ModuleWatcher::read_events(WatchChanges& changes) {
+    alignas(struct inotify_event) char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd_, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return true;
+        if (n <= 0) {
+            LOG_ERROR("inotify read failed: " + std::string(n < 0 ? strerror(errno) : "EOF"));
+            return false;
+        }
+
+        for (char* p = buf; p < buf + n;) {
+            const auto* ev = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            std::string name = ev->len ? ev->name : "";
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were lost, so which modules changed is unknown
+                changes.config = true;
+                continue;
+            }
+            // A watch may be BASE_DIR and the config file's directory at once
+            if ((ev->wd == base_wd_ && is_config_name(name)) ||
+                (ev->wd == config_wd_ && name == config_file_.filename().string())) {
+                changes.config = true;
+            }
+            if (ev->wd == moduledir_wd_) {
+                if (!is_module_name(name)) continue;
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) watch_module(name);
+                changes.modules.insert(name);
+            } else if (ev->wd == hot_unmount_wd_) {
+                if (!name.empty()) changes.modules.insert(name);
+            } else {
+                auto it = module_wds_.find(ev->wd);
+                if (it == module_wds_.end()) continue;
+                if (ev->mask & IN_IGNORED) {
+                    // Directory gone; the module directory watch reports the removal
+                    module_wds_.erase(it);
+                } else {
+                    changes.modules.insert(it->second);
+                }
+            }
+        }
+    }
+}
+
+bool ModuleWatcher::wait(WatchChanges& changes) {
+    changes = WatchChanges();
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    auto settle = [&](int timeout) -> int {
+        int r;
+        do {
+            r = poll(&pfd, 1, timeout);
+        } while (r < 0 && errno == EINTR);
+        if (r < 0) LOG_ERROR("poll on inotify failed: " + std::string(strerror(errno)));
+        return r;
+    };
+
+    // Idle: sleep until an event that matters
+    while (changes.modules.empty() && !changes.config) {
+        if (settle(-1) < 0 || !read_events(changes)) return false;
+    }
+
+    // Burst: collect until quiet for DEBOUNCE_MS
+    auto first = std::chrono::steady_clock::now();
+    for (;;) {
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - first);
+        int left = MAX_DELAY_MS - static_cast<int>(waited.count());
+        if (left <= 0) break;
+        int r = settle(std::min(DEBOUNCE_MS, left));
+        if (r < 0) return false;
+        if (r == 0) break;
+        if (!read_events(changes)) return false;
+    }
+    return true;
+}
+
+} // namespace hymo
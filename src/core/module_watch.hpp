@@ -0,0 +1,57 @@
+// core/module_watch.hpp - inotify watch on modules and hymo configuration
+#pragma once
+
+#include <string>
+#include <set>
+#include <map>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// What changed during one burst of events
+struct WatchChanges {
+    std::set<std::string> modules; // ids whose directory, markers or hot unmount changed
+    bool config = false;           // a config file changed; everything needs a reload
+};
+
+// Watches the module directory and the top level of each module in it (module.prop,
+// disable/remove/skip_mount markers, hymo_rules.conf, partition directories), the
+// config files and the hot unmount markers. Edits deeper inside a module are not
+// seen; KernelSU replaces a module as a whole when updating it. Blocks in poll()
+// while idle, so an idle watch costs no wakeups.
+class ModuleWatcher {
+public:
+    // Wait this long after the last event before reporting a burst, but no more
+    // than MAX_DELAY_MS after its first event
+    static constexpr int DEBOUNCE_MS = 300;
+    static constexpr int MAX_DELAY_MS = 3000;
+
+    ModuleWatcher(const fs::path& moduledir, const fs::path& config_file);
+    ~ModuleWatcher();
+    ModuleWatcher(const ModuleWatcher&) = delete;
+    ModuleWatcher& operator=(const ModuleWatcher&) = delete;
+
+    bool start();
+    // Block until something changed and the burst settled; false on error
+    bool wait(WatchChanges& changes);
+
+private:
+    int add_watch(const fs::path& dir, uint32_t mask);
+    void watch_module(const std::string& id);
+    // Drain pending events into changes; false on read error
+    bool read_events(WatchChanges& changes);
+
+    fs::path moduledir_;
+    fs::path config_file_;
+    int fd_ = -1;
+    int moduledir_wd_ = -1;
+    int base_wd_ = -1;
+    int config_wd_ = -1;
+    int hot_unmount_wd_ = -1;
+    std::map<int, std::string> module_wds_; // watch -> module id
+};
+
+} // namespace hymo
@@ -1,6 +1,7 @@
 // core/modules.cpp - Module description updates implementation
 #include "modules.hpp"
 #include "inventory.hpp"
+#include "module_tree.hpp"
 #include "../defs.hpp"
 #include "../utils.hpp"
 #include "../mount/hymofs.hpp"
@@ -10,30 +11,10 @@
 
 namespace hymo {
 
-static std::string json_escape(const std::string& s) {
-    std::ostringstream o;
-    for (char c : s) {
-        if (c == '"') o << "\\\"";
-        else if (c == '\\') o << "\\\\";
-        else if (c == '\b') o << "\\b";
-        else if (c == '\f') o << "\\f";
-        else if (c == '\n') o << "\\n";
-        else if (c == '\r') o << "\\r";
-        else if (c == '\t') o << "\\t";
-        else if ((unsigned char)c < 0x20) {
-            char buf[7];
-            snprintf(buf, sizeof(buf), "\\u%04x", c);
-            o << buf;
-        }
-        else o << c;
-    }
-    return o.str();
-}
-
-static bool has_content(const fs::path& module_path, const std::vector<std::string>& all_partitions) {
+static bool has_content(const Module& module, const std::vector<std::string>& all_partitions) {
+    const ModuleTree& tree = ModuleIndex::global().get(module.id, module.source_path);
     for (const auto& partition : all_partitions) {
-        fs::path part_path = module_path / partition;
-        if (has_files_recursive(part_path)) {
+        if (tree.has_files(partition)) {
             return true;
         }
     }
@@ -105,6 +86,9 @@ void update_module_description(
 }
 
 void print_module_list(const Config& config) {
+    // Content checks come from the saved index; only changed directories are read.
+    // Listing never writes it back: that is left to mount and reload.
+    ModuleIndex::global().load(MODULE_INDEX_FILE);
     auto modules = scan_modules(config.moduledir, config);
     
     // Build complete partition list (builtin + extra)
@@ -116,7 +100,7 @@ void print_module_list(const Config& config) {
     // Filter modules with actual content (including extra partitions)
     std::vector<Module> filtered_modules;
     for (const auto& module : modules) {
-        if (has_content(module.source_path, all_partitions)) {
+        if (has_content(module, all_partitions)) {
             filtered_modules.push_back(module);
         }
     }
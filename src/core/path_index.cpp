@@ -0,0 +1,29 @@
+// core/path_index.cpp - Set of directories for subtree coverage queries implementation
+#include "path_index.hpp"
+
+namespace hymo {
+
+const std::string* PathIndex::covering(std::string_view path) const {
+    if (dirs_.empty()) return nullptr;
+
+    auto it = dirs_.find(path);
+    if (it != dirs_.end()) return &*it;
+    // Ancestors end right before a '/', the deepest one first
+    for (size_t slash = path.rfind('/'); slash != std::string_view::npos; slash = path.rfind('/', slash - 1)) {
+        it = dirs_.find(path.substr(0, slash));
+        if (it != dirs_.end()) return &*it;
+        if (slash == 0) break;
+    }
+    return nullptr;
+}
+
+bool PathIndex::any_at_or_below(std::string_view dir) const {
+    if (dirs_.count(dir)) return true;
+    // Everything below dir sorts together right after dir + "/"
+    std::string children(dir);
+    children += '/';
+    auto it = dirs_.lower_bound(children);
+    return it != dirs_.end() && it->compare(0, children.size(), children) == 0;
+}
+
+} // namespace hymo
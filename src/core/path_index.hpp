@@ -0,0 +1,33 @@
+// core/path_index.hpp - Set of directories for subtree coverage queries
+#pragma once
+
+#include <set>
+#include <string>
+#include <string_view>
+#include <functional>
+
+namespace hymo {
+
+// Directories (mount targets and the like) that each cover their own subtree. A
+// query looks up the path's ancestors instead of scanning every directory.
+class PathIndex {
+public:
+    void insert(const std::string& dir) { dirs_.insert(dir); }
+    void clear() { dirs_.clear(); }
+    size_t size() const { return dirs_.size(); }
+    bool empty() const { return dirs_.empty(); }
+
+    // The deepest directory that is path or one of its ancestors, or nullptr
+    const std::string* covering(std::string_view path) const;
+    bool covers(std::string_view path) const { return covering(path) != nullptr; }
+    // Whether some directory is dir or lies below it
+    bool any_at_or_below(std::string_view dir) const;
+
+    std::set<std::string, std::less<>>::const_iterator begin() const { return dirs_.begin(); }
+    std::set<std::string, std::less<>>::const_iterator end() const { return dirs_.end(); }
+
+private:
+    std::set<std::string, std::less<>> dirs_;
+};
+
+} // namespace hymo
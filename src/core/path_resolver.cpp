@@ -0,0 +1,72 @@
+// core/path_resolver.cpp - Per-run memo of resolved system directories implementation
+#include "path_resolver.hpp"
+#include <filesystem>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+PathResolver& PathResolver::global() {
+    static PathResolver resolver;
+    return resolver;
+}
+
+// Parents first, so each component costs one lstat(); only a symlink is handed to
+// fs::canonical(). References stay valid as the map grows (node-based).
+const std::string& PathResolver::resolve_dir_locked(const std::string& dir) {
+    auto it = dirs_.find(dir);
+    if (it != dirs_.end()) {
+        return it->second;
+    }
+
+    std::string resolved = dir;
+    size_t slash = dir.rfind('/');
+    if (dir.size() > 1 && slash != std::string::npos && dir[0] == '/') {
+        const std::string& base = resolve_dir_locked(slash == 0 ? "/" : dir.substr(0, slash));
+        resolved = (base == "/" ? "" : base) + dir.substr(slash);
+
+        struct stat st;
+        lookups_++;
+        if (lstat(dir.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+            std::error_code ec;
+            fs::path target = fs::canonical(dir, ec);
+            // A dangling link resolves to nothing; keep the name like a missing directory
+            if (!ec) resolved = target.string();
+        }
+    }
+    return dirs_.emplace(dir, std::move(resolved)).first->second;
+}
+
+std::string PathResolver::resolve_parent(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos || slash == 0 || path[0] != '/') {
+        return path;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string& parent = resolve_dir_locked(path.substr(0, slash));
+    return (parent == "/" ? "" : parent) + path.substr(slash);
+}
+
+std::string PathResolver::resolve(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resolve_dir_locked(path);
+}
+
+void PathResolver::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dirs_.clear();
+    lookups_ = 0;
+}
+
+size_t PathResolver::cached() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dirs_.size();
+}
+
+size_t PathResolver::lookups() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lookups_;
+}
+
+} // namespace hymo
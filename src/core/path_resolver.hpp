@@ -0,0 +1,36 @@
+// core/path_resolver.hpp - Per-run memo of resolved system directories
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+
+namespace hymo {
+
+// Resolves symlinks in system paths with one lstat() per distinct directory. Rule
+// paths come by the thousand but share a few hundred parents. Answers reflect the
+// filesystem as first seen, so clear() whenever mounts may have changed it.
+class PathResolver {
+public:
+    static PathResolver& global();
+
+    // Directories of path resolved, its last component kept as is (a rule may target
+    // a symlink itself). Components that don't exist are kept literally.
+    std::string resolve_parent(const std::string& path);
+    // Every component resolved, as fs::canonical() would for a path that exists
+    std::string resolve(const std::string& path);
+
+    void clear();
+    size_t cached() const;
+    size_t lookups() const;
+
+private:
+    const std::string& resolve_dir_locked(const std::string& dir);
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::string> dirs_; // path -> resolved path
+    size_t lookups_ = 0;
+};
+
+} // namespace hymo
@@ -0,0 +1,243 @@
+// core/plan_cache.cpp - Replay of the previous boot's mount plan implementation
+#include "plan_cache.hpp"
+#include "module_tree.hpp"
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include "../mount/hymofs.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <dirent.h>
+#include <sys/utsname.h>
+
+namespace hymo {
+
+static constexpr const char* CACHE_HEADER = "hymo-plan-cache 2";
+
+namespace {
+
+// Same multiply/rotate mix as hash_file(), over a stream of fields
+class Fingerprint {
+public:
+    void add_u64(uint64_t v) {
+        h_ = (h_ ^ v) * PRIME;
+        h_ = (h_ << 31) | (h_ >> 33);
+    }
+    void add(const std::string& s) {
+        add_u64(s.size());
+        for (unsigned char c : s) {
+            h_ = (h_ ^ c) * PRIME;
+        }
+    }
+    void add_file(const fs::path& path) {
+        uint64_t hash = 0;
+        bool present = hash_file(path, hash);
+        add_u64(present);
+        add_u64(hash);
+    }
+    uint64_t value() const {
+        uint64_t h = h_;
+        h ^= h >> 29;
+        h *= PRIME;
+        h ^= h >> 32;
+        return h ? h : 1;
+    }
+
+private:
+    static constexpr uint64_t PRIME = 0x9E3779B97F4A7C15ULL;
+    uint64_t h_ = 0xCBF29CE484222325ULL;
+};
+
+} // namespace
+
+uint64_t plan_fingerprint(
+    const Config& config,
+    const fs::path& config_file,
+    const std::vector<Module>& modules,
+    const fs::path& storage_root
+) {
+    Fingerprint fp;
+    fp.add(CACHE_HEADER);
+
+    // Config as loaded plus the values the command line can override
+    fp.add_file(config_file);
+    fp.add_file(fs::path(BASE_DIR) / "module_mode.conf");
+    fp.add_file(fs::path(BASE_DIR) / "module_rules.conf");
+    fp.add(config.moduledir.string());
+    fp.add(storage_root.string());
+    std::vector<std::string> target_partitions = BUILTIN_PARTITIONS;
+    for (const auto& part : config.partitions) {
+        target_partitions.push_back(part);
+    }
+    for (const auto& part : target_partitions) {
+        fp.add(part);
+    }
+
+    // Kernel and the partitions the plan resolves targets against (an OTA changes these)
+    struct utsname uts;
+    if (uname(&uts) == 0) {
+        fp.add(uts.release);
+        fp.add(uts.version);
+    }
+    fp.add_u64((uint64_t)HymoFS::check_status());
+    fp.add_u64((uint64_t)(int64_t)HymoFS::get_protocol_version());
+    fp.add_file("/system/build.prop");
+    fp.add_file("/vendor/build.prop");
+
+    // Module list in priority order with everything the planner reads per module
+    fp.add_u64(modules.size());
+    for (const auto& module : modules) {
+        fp.add(module.id);
+        fp.add(module.mode);
+        fp.add_u64(module.rules.size());
+        for (const auto& rule : module.rules) {
+            fp.add(rule.path);
+            fp.add(rule.mode);
+        }
+        fp.add_file(module.source_path / "module.prop");
+        fp.add_file(module.source_path / "hymo_rules.conf");
+
+        const ModuleTree& tree = ModuleIndex::global().get(module.id, module.source_path);
+        if (!tree.complete()) {
+            return 0;
+        }
+        for (const auto& part : target_partitions) {
+            // The planner walks through a symlinked partition root, the index does not
+            long i = tree.find(part);
+            if (i >= 0 && S_ISLNK(tree.entries()[i].mode)) {
+                return 0;
+            }
+        }
+        // Layout only: sizes and times don't change the plan or the rules
+        fp.add_u64(tree.entries().size());
+        for (const auto& e : tree.entries()) {
+            fp.add(e.rel);
+            fp.add_u64(e.mode);
+            fp.add_u64(e.rdev);
+            fp.add_u64(e.end);
+            fp.add_u64(e.flags);
+        }
+    }
+    return fp.value();
+}
+
+static std::string hex64(uint64_t v) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+    return buf;
+}
+
+bool load_plan_cache(uint64_t fingerprint, MountPlan& plan, HymoRules& rules) {
+    std::ifstream file(PLAN_CACHE_FILE);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != CACHE_HEADER) {
+        return false;
+    }
+    if (!std::getline(file, line) || line != "fingerprint\t" + hex64(fingerprint)) {
+        LOG_DEBUG("Plan cache: inputs changed since it was written");
+        return false;
+    }
+
+    MountPlan cached;
+    HymoRules cached_rules;
+    bool complete = false;
+    while (std::getline(file, line)) {
+        auto f = split_tabs(line);
+        const std::string& key = f[0];
+        if (key == "end" && f.size() == 1) {
+            complete = true;
+            break;
+        } else if (key == "overlay" && f.size() == 2) {
+            cached.overlay_ops.push_back(OverlayOperation{f[1], {}});
+        } else if (key == "layer" && f.size() == 2 && !cached.overlay_ops.empty()) {
+            cached.overlay_ops.back().lowerdirs.push_back(f[1]);
+        } else if (key == "magic" && f.size() == 2) {
+            cached.magic_module_paths.push_back(f[1]);
+        } else if (key == "overlay_id" && f.size() == 2) {
+            cached.overlay_module_ids.push_back(f[1]);
+        } else if (key == "magic_id" && f.size() == 2) {
+            cached.magic_module_ids.push_back(f[1]);
+        } else if (key == "hymofs_id" && f.size() == 2) {
+            cached.hymofs_module_ids.push_back(f[1]);
+        } else if (key == "add" && f.size() == 5) {
+            int type = rule_type_from_name(f[2]);
+            if (type < 0) return false;
+            if (!f[1].empty()) cached_rules.owners[f[3]] = f[1];
+            cached_rules.add_rules.push_back(HymoAddRule{f[3], f[4], type});
+        } else if (key == "hide" && f.size() == 3) {
+            if (!f[1].empty()) cached_rules.owners[f[2]] = f[1];
+            cached_rules.hide_rules.push_back(f[2]);
+        } else {
+            LOG_WARN("Plan cache: ignoring malformed file");
+            return false;
+        }
+    }
+    if (!complete) {
+        return false;
+    }
+
+    cached.index_targets();
+    plan = std::move(cached);
+    rules = std::move(cached_rules);
+    return true;
+}
+
+bool save_plan_cache(uint64_t fingerprint, const MountPlan& plan, const HymoRules& rules) {
+    std::ostringstream out;
+    bool storable = true;
+    auto field = [&](const std::string& s) -> const std::string& {
+        if (s.find_first_of("\t\n") != std::string::npos) storable = false;
+        return s;
+    };
+
+    out << CACHE_HEADER << "\n";
+    out << "fingerprint\t" << hex64(fingerprint) << "\n";
+    for (const auto& op : plan.overlay_ops) {
+        out << "overlay\t" << field(op.target) << "\n";
+        for (const auto& layer : op.lowerdirs) {
+            out << "layer\t" << field(layer.string()) << "\n";
+        }
+    }
+    for (const auto& path : plan.magic_module_paths) {
+        out << "magic\t" << field(path.string()) << "\n";
+    }
+    for (const auto& id : plan.overlay_module_ids) {
+        out << "overlay_id\t" << field(id) << "\n";
+    }
+    for (const auto& id : plan.magic_module_ids) {
+        out << "magic_id\t" << field(id) << "\n";
+    }
+    for (const auto& id : plan.hymofs_module_ids) {
+        out << "hymofs_id\t" << field(id) << "\n";
+    }
+    auto owner = [&](const std::string& path) {
+        auto it = rules.owners.find(path);
+        return it == rules.owners.end() ? std::string() : it->second;
+    };
+    for (const auto& rule : rules.add_rules) {
+        out << "add\t" << field(owner(rule.src)) << "\t" << rule_type_name(rule.type) << "\t" << field(rule.src)
+            << "\t" << field(rule.target) << "\n";
+    }
+    for (const auto& path : rules.hide_rules) {
+        out << "hide\t" << field(owner(path)) << "\t" << field(path) << "\n";
+    }
+    out << "end\n";
+
+    fs::path cache_file = PLAN_CACHE_FILE;
+    if (!storable) {
+        // Not representable in the line format; make sure no stale cache is replayed
+        LOG_DEBUG("Plan cache: plan has paths with tabs or newlines, not caching");
+        std::error_code ec;
+        fs::remove(cache_file, ec);
+        return false;
+    }
+
+    return write_file_atomic(cache_file, out.str());
+}
+
+} // namespace hymo
@@ -0,0 +1,28 @@
+// core/plan_cache.hpp - Replay of the previous boot's mount plan
+#pragma once
+
+#include "planner.hpp"
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// Fingerprint of everything generate_plan() and build_hymofs_rules() depend on for
+// these modules: config and rule files, module.prop and hymo_rules.conf of each
+// module, the module index, the kernel and HymoFS protocol version and the system
+// build. Returns 0 if the inputs can't be captured (e.g. a module tree that could
+// not be indexed), which never matches a cache.
+uint64_t plan_fingerprint(
+    const Config& config,
+    const fs::path& config_file,
+    const std::vector<Module>& modules,
+    const fs::path& storage_root
+);
+
+// Plan and HymoFS rules saved under the same fingerprint, if any
+bool load_plan_cache(uint64_t fingerprint, MountPlan& plan, HymoRules& rules);
+bool save_plan_cache(uint64_t fingerprint, const MountPlan& plan, const HymoRules& rules);
+
+} // namespace hymo
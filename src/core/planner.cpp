@@ -1,18 +1,52 @@
 // core/planner.cpp - Mount planning implementation
 #include "planner.hpp"
+#include "module_tree.hpp"
+#include "applied_rules.hpp"
+#include "conflict_report.hpp"
+#include "path_resolver.hpp"
+#include "rule_trie.hpp"
 #include "../defs.hpp"
 #include "../utils.hpp"
+#include "../walker.hpp"
 #include "../mount/hymofs.hpp"
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <algorithm>
+#include <functional>
+#include <cerrno>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <dirent.h>
 
 namespace hymo {
 
+static bool at_or_below(const std::string& path, const std::string& dir) {
+    return path == dir || (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 && path[dir.size()] == '/');
+}
+
+void MountPlan::index_targets() {
+    overlay_targets.clear();
+    for (const auto& op : overlay_ops) {
+        overlay_targets.insert(op.target);
+    }
+    indexed_ops_ = overlay_ops.size();
+}
+
+bool MountPlan::has_overlay_at_or_below(const std::string& dir) const {
+    if (indexed_ops_ == overlay_ops.size()) {
+        return overlay_targets.any_at_or_below(dir);
+    }
+    for (const auto& op : overlay_ops) {
+        if (at_or_below(op.target, dir)) return true;
+    }
+    return false;
+}
+
 bool MountPlan::is_covered_by_overlay(const std::string& path) const {
+    if (indexed_ops_ == overlay_ops.size()) {
+        return overlay_targets.covers(path);
+    }
     for (const auto& op : overlay_ops) {
         std::string p_str = path;
         std::string t_str = op.target;
@@ -43,10 +77,50 @@ static bool has_files(const fs::path& path) {
     return false;
 }
 
-static bool has_meaningful_content(const fs::path& base, const std::vector<std::string>& partitions) {
+// The module index describes the storage/mirror copy unless the partition root is
+// a symlink (followed by the filesystem walk, not by the index) or the walk failed
+static bool index_covers(const ModuleTree& tree, const std::string& part) {
+    if (!tree.complete()) return false;
+    long i = tree.find(part);
+    return i < 0 || !S_ISLNK(tree.entries()[i].mode);
+}
+
+static bool part_has_entries(const ModuleTree& tree, const fs::path& content_path, const std::string& part) {
+    if (!index_covers(tree, part)) {
+        return has_files(content_path / part);
+    }
+    auto [begin, end] = tree.subtree(part);
+    return begin < end;
+}
+
+using PartVisitor = std::function<WalkAction(const std::string& rel, const struct stat& st)>;
+
+// Visit everything below content_path/part (rel is relative to it), in walk order
+static std::error_code visit_partition(const ModuleTree& tree, const fs::path& content_path, const std::string& part,
+                                       const PartVisitor& fn) {
+    if (!index_covers(tree, part)) {
+        return walk_tree(content_path / part, [&](const WalkEntry& entry) { return fn(entry.rel, entry.st); });
+    }
+
+    auto [begin, end] = tree.subtree(part);
+    const auto& entries = tree.entries();
+    for (uint32_t i = begin; i < end;) {
+        const TreeEntry& e = entries[i];
+        struct stat st = {};
+        st.st_mode = e.mode;
+        st.st_size = e.size;
+        st.st_rdev = e.rdev;
+
+        WalkAction action = fn(e.rel.substr(part.size() + 1), st);
+        if (action == WalkAction::Stop) break;
+        i = action == WalkAction::SkipSubtree ? e.end : i + 1;
+    }
+    return {};
+}
+
+static bool has_meaningful_content(const ModuleTree& tree, const fs::path& base, const std::vector<std::string>& partitions) {
     for (const auto& part : partitions) {
-        fs::path p = base / part;
-        if (fs::exists(p) && has_files(p)) {
+        if (part_has_entries(tree, base, part)) {
             return true;
         }
     }
@@ -58,37 +132,7 @@ static bool has_meaningful_content(const fs::path& base, const std::vector<std::
 // are correctly mapped to /storage/emulated/0/foo, while preserving the ability
 // to target a symlink file itself (e.g. replacing a symlink).
 static std::string resolve_path_for_hymofs(const std::string& path_str) {
-    try {
-        fs::path p(path_str);
-        if (!p.has_parent_path()) return path_str;
-        
-        fs::path parent = p.parent_path();
-        fs::path filename = p.filename();
-        
-        fs::path curr = parent;
-        std::vector<fs::path> suffix;
-        
-        // Walk up until we find an existing path
-        while (!curr.empty() && curr != "/" && !fs::exists(curr)) {
-            suffix.push_back(curr.filename());
-            curr = curr.parent_path();
-        }
-        
-        // Resolve the existing base
-        if (fs::exists(curr)) {
-            curr = fs::canonical(curr);
-        }
-        
-        // Re-append the non-existing suffix
-        for (auto it = suffix.rbegin(); it != suffix.rend(); ++it) {
-            curr /= *it;
-        }
-        
-        curr /= filename;
-        return curr.string();
-    } catch (...) {
-        return path_str;
-    }
+    return PathResolver::global().resolve_parent(path_str);
 }
 
 MountPlan generate_plan(
@@ -97,6 +141,9 @@ MountPlan generate_plan(
     const fs::path& storage_root
 ) {
     MountPlan plan;
+    // Resolved paths are valid for this planning pass only
+    PathResolver& resolver = PathResolver::global();
+    resolver.clear();
     
     std::map<std::string, std::vector<fs::path>> overlay_layers;
     std::set<fs::path> magic_paths;
@@ -116,7 +163,10 @@ MountPlan generate_plan(
         fs::path content_path = storage_root / module.id;
         
         if (!fs::exists(content_path)) continue;
-        if (!has_meaningful_content(content_path, target_partitions)) continue;
+        // Storage holds a copy of (or is bound to) the module source
+        const ModuleTree& tree = ModuleIndex::global().get(module.id, module.source_path);
+        ModuleIndex::global().alias(content_path, module.source_path);
+        if (!has_meaningful_content(tree, content_path, target_partitions)) continue;
         
         // Determine default mode
         std::string default_mode = module.mode;
@@ -144,7 +194,7 @@ MountPlan generate_plan(
                 bool participates_in_overlay = false;
                 for (const auto& part : target_partitions) {
                     fs::path part_path = content_path / part;
-                    if (fs::is_directory(part_path) && has_files(part_path)) {
+                    if (part_has_entries(tree, content_path, part)) {
                         std::string part_root = "/" + part;
                         overlay_layers[part_root].push_back(part_path);
                         participates_in_overlay = true;
@@ -156,6 +206,7 @@ MountPlan generate_plan(
             }
         } else {
             // Mixed mode handling
+            RuleTrie rule_trie(module.rules);
             bool hymofs_active = false;
             bool overlay_active = false;
             bool magic_active = false;
@@ -164,56 +215,29 @@ MountPlan generate_plan(
                 fs::path part_root = content_path / part;
                 if (!fs::exists(part_root)) continue;
                 
-                for (const auto& entry : fs::recursive_directory_iterator(part_root)) {
-                    fs::path rel = fs::relative(entry.path(), content_path);
-                    std::string path_str = "/" + rel.string();
+                std::error_code ec = visit_partition(tree, content_path, part, [&](const std::string& rel, const struct stat& st) {
+                    std::string path_str = "/" + part + "/" + rel;
                     
-                    std::string mode = default_mode;
-                    size_t max_len = 0;
-                    bool rule_found = false;
+                    RuleTrie::Match match = rule_trie.match(path_str);
+                    const std::string& mode = match.mode ? *match.mode : default_mode;
+                    bool rule_found = match.mode != nullptr;
                     
-                    for (const auto& rule : module.rules) {
-                        if (path_str == rule.path || 
-                           (path_str.size() > rule.path.size() && path_str.compare(0, rule.path.size(), rule.path) == 0 && path_str[rule.path.size()] == '/')) {
-                            if (rule.path.size() > max_len) {
-                                max_len = rule.path.size();
-                                mode = rule.mode;
-                                rule_found = true;
-                            }
-                        }
-                    }
-                    
-                    if (mode == "none") continue;
+                    if (mode == "none") return WalkAction::Continue;
 
-                    if (entry.is_directory()) {
+                    if (S_ISDIR(st.st_mode)) {
                         if (mode == "overlay") {
-                            bool is_exact_rule = false;
-                            for (const auto& rule : module.rules) {
-                                if (rule.path == path_str && rule.mode == "overlay") {
-                                    is_exact_rule = true;
-                                    break;
-                                }
-                            }
-                            
-                            if (is_exact_rule) {
-                                overlay_layers[path_str].push_back(entry.path());
+                            if (match.exact_has("overlay")) {
+                                overlay_layers[path_str].push_back(part_root / rel);
                                 overlay_active = true;
                             } else if (!rule_found && default_mode == "overlay") {
-                                if (entry.path() == part_root) {
-                                    overlay_layers["/" + part].push_back(entry.path());
+                                if (rel.empty()) {
+                                    overlay_layers["/" + part].push_back(part_root);
                                     overlay_active = true;
                                 }
                             }
                         } else if (mode == "magic") {
-                            bool is_exact_rule = false;
-                            for (const auto& rule : module.rules) {
-                                if (rule.path == path_str && rule.mode == "magic") {
-                                    is_exact_rule = true;
-                                    break;
-                                }
-                            }
-                            if (is_exact_rule) {
-                                magic_paths.insert(entry.path());
+                            if (match.exact_has("magic")) {
+                                magic_paths.insert(part_root / rel);
                                 magic_active = true;
                             }
                         } else if (mode == "hymofs") {
@@ -224,6 +248,10 @@ MountPlan generate_plan(
                     if (mode == "hymofs") {
                         hymofs_active = true;
                     }
+                    return WalkAction::Continue;
+                });
+                if (ec) {
+                    LOG_WARN("Error scanning module " + module.id + ": " + ec.message());
                 }
             }
             
@@ -259,13 +287,7 @@ MountPlan generate_plan(
         // Resolve symlinks for target
         fs::path target_path(target);
         if (fs::is_symlink(target_path)) {
-             try {
-                 target_path = fs::read_symlink(target_path);
-                 if (target_path.is_relative()) {
-                     target_path = fs::path(target).parent_path() / target_path;
-                 }
-                 target_path = fs::canonical(target_path);
-             } catch (...) {}
+            target_path = resolver.resolve(target);
         }
         
         if (!fs::exists(target_path) || !fs::is_directory(target_path)) {
@@ -275,6 +297,7 @@ MountPlan generate_plan(
         plan.overlay_ops.push_back(OverlayOperation{target_path.string(), layers});
     }
     
+    plan.index_targets();
     plan.magic_module_paths.assign(magic_paths.begin(), magic_paths.end());
     plan.overlay_module_ids.assign(overlay_ids.begin(), overlay_ids.end());
     plan.magic_module_ids.assign(magic_ids.begin(), magic_ids.end());
@@ -282,30 +305,179 @@ MountPlan generate_plan(
     return plan;
 }
 
-struct AddRule {
-    std::string src;
-    std::string target;
-    int type;
+namespace {
+
+// Whether a path is missing from the system as HymoFS found it. During a reload the
+// rules applied earlier in this boot are visible to lstat(), so the paths they may
+// have created or hidden count as present, except directories they redirected.
+class StockView {
+public:
+    void load() {
+        HymoRules applied;
+        if (!load_applied_rules(applied)) return;
+        for (const auto& rule : applied.add_rules) {
+            if (rule.type == DT_DIR) redirected_.insert(rule.src);
+            // The kernel makes up the parents of an added path
+            for (std::string p = rule.src; p.size() > 1 && injected_.insert(p).second;) {
+                p = fs::path(p).parent_path().string();
+            }
+        }
+        hidden_.insert(applied.hide_rules.begin(), applied.hide_rules.end());
+    }
+
+    bool absent(const std::string& path) const {
+        if (redirected_.count(path)) return true;
+        if (injected_.count(path) || hidden_.count(path) || below_any(path, redirected_) || below_any(path, hidden_)) {
+            return false;
+        }
+        struct stat st;
+        return lstat(path.c_str(), &st) != 0 && errno == ENOENT;
+    }
+
+private:
+    static bool below_any(const std::string& path, const std::set<std::string>& dirs) {
+        for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            if (dirs.count(path.substr(0, slash))) return true;
+        }
+        return false;
+    }
+
+    std::set<std::string> redirected_;
+    std::set<std::string> injected_;
+    std::set<std::string> hidden_;
 };
 
-void update_hymofs_mappings(
+// Rules as the modules provide them, lowest priority first. Each path gets the rule of
+// the last module providing it, except that a hide rule from module configuration is
+// never overridden. Only those winners are submitted.
+class RuleMerger {
+public:
+    void add(const std::string& module, HymoAddRule rule) {
+        provided_.push_back({module, std::move(rule), false, false});
+    }
+    void hide(const std::string& module, const std::string& path, bool configured) {
+        provided_.push_back({module, HymoAddRule{path, "", 0}, true, configured});
+    }
+    size_t size() const { return provided_.size(); }
+
+    HymoRules finish(HymoConflictReport* report) const {
+        std::unordered_map<std::string, uint32_t> winner;
+        std::unordered_map<std::string, std::vector<uint32_t>> shared; // path -> every provider
+        winner.reserve(provided_.size());
+        for (uint32_t i = 0; i < provided_.size(); i++) {
+            auto [it, first] = winner.emplace(provided_[i].rule.src, i);
+            if (first) continue;
+            auto& all = shared[it->first];
+            if (all.empty()) all.push_back(it->second);
+            all.push_back(i);
+            const Provided& current = provided_[it->second];
+            if (!(current.hide && current.configured)) it->second = i;
+        }
+
+        HymoRules rules;
+        for (uint32_t i = 0; i < provided_.size(); i++) {
+            const Provided& p = provided_[i];
+            if (winner[p.rule.src] != i) continue;
+            if (p.hide) {
+                rules.hide_rules.push_back(p.rule.src);
+            } else {
+                rules.add_rules.push_back(p.rule);
+            }
+            rules.owners[p.rule.src] = p.module;
+        }
+
+        if (report) {
+            *report = HymoConflictReport();
+            std::map<std::string, std::set<std::string>> paths; // module -> paths it provides
+            for (const auto& p : provided_) paths[p.module].insert(p.rule.src);
+            for (const auto& [module, set] : paths) report->provided[module] = set.size();
+
+            std::vector<std::string> shared_paths;
+            for (const auto& [path, all] : shared) shared_paths.push_back(path);
+            std::sort(shared_paths.begin(), shared_paths.end());
+            for (const auto& path : shared_paths) {
+                HymoConflict conflict{path, provided_[winner[path]].module, {}};
+                const auto& all = shared[path];
+                for (auto i = all.rbegin(); i != all.rend(); ++i) {
+                    const std::string& module = provided_[*i].module;
+                    if (module != conflict.winner &&
+                        std::find(conflict.shadowed.begin(), conflict.shadowed.end(), module) == conflict.shadowed.end()) {
+                        conflict.shadowed.push_back(module);
+                    }
+                }
+                // A module repeating its own path is not a conflict
+                if (!conflict.shadowed.empty()) report->conflicts.push_back(std::move(conflict));
+            }
+        }
+        return rules;
+    }
+
+private:
+    struct Provided {
+        std::string module;
+        HymoAddRule rule; // src is the path for hide rules too
+        bool hide;
+        bool configured;
+    };
+    std::vector<Provided> provided_;
+};
+
+} // namespace
+
+const char* rule_type_name(int type) {
+    return type == DT_DIR ? "dir" : type == DT_LNK ? "lnk" : "reg";
+}
+
+int rule_type_from_name(const std::string& name) {
+    if (name == "reg") return DT_REG;
+    if (name == "lnk") return DT_LNK;
+    if (name == "dir") return DT_DIR;
+    return -1;
+}
+
+HymoRules HymoRules::of_module(const std::string& module) const {
+    auto owned = [&](const std::string& path) {
+        auto it = owners.find(path);
+        return it != owners.end() && it->second == module;
+    };
+    HymoRules rules;
+    for (const auto& rule : add_rules) {
+        if (owned(rule.src)) rules.add_rules.push_back(rule);
+    }
+    for (const auto& path : hide_rules) {
+        if (owned(path)) rules.hide_rules.push_back(path);
+    }
+    for (const auto& [path, owner] : owners) {
+        if (owner == module) rules.owners.emplace(path, owner);
+    }
+    return rules;
+}
+
+void HymoRules::erase(const std::set<std::string>& paths) {
+    if (paths.empty()) return;
+    add_rules.erase(std::remove_if(add_rules.begin(), add_rules.end(),
+                                   [&](const HymoAddRule& rule) { return paths.count(rule.src) > 0; }),
+                    add_rules.end());
+    hide_rules.erase(std::remove_if(hide_rules.begin(), hide_rules.end(),
+                                    [&](const std::string& path) { return paths.count(path) > 0; }),
+                     hide_rules.end());
+    for (const auto& path : paths) owners.erase(path);
+}
+
+HymoRules build_hymofs_rules(
     const Config& config,
     const std::vector<Module>& modules,
     const fs::path& storage_root,
-    const MountPlan& plan
+    const MountPlan& plan,
+    HymoConflictReport* report
 ) {
-    if (!HymoFS::is_available()) return;
-
-    // Clear existing mappings
-    HymoFS::clear_rules();
-
     std::vector<std::string> target_partitions = BUILTIN_PARTITIONS;
     for (const auto& part : config.partitions) {
         target_partitions.push_back(part);
     }
 
-    std::vector<AddRule> add_rules;
-    std::vector<std::string> hide_rules;
+    RuleMerger merger;
+    std::vector<std::string> configured_hides;
 
     // Process explicit hide rules from module configuration
     for (const auto& module : modules) {
@@ -317,13 +489,69 @@ void update_hymofs_mappings(
 
         for (const auto& rule : module.rules) {
             if (rule.mode == "hide") {
-                hide_rules.push_back(resolve_path_for_hymofs(rule.path));
+                configured_hides.push_back(resolve_path_for_hymofs(rule.path));
+                merger.hide(module.id, configured_hides.back(), true);
             }
         }
     }
 
-    // Iterate in reverse (Lowest Priority -> Highest Priority)
-    // Assuming "Last Write Wins" in kernel module
+    // Compaction: a module directory with nothing to merge with, neither on the system
+    // nor in another module, is mapped by one DT_DIR rule instead of one per file. So
+    // is one marked to replace its system counterpart as a whole.
+    bool compact = config.compact_rules && HymoFS::supports_dir_rules();
+    StockView stock;
+    if (compact) stock.load();
+
+    // Files the directory rule at part/rel stands for, or 0 if it can't have one
+    auto dir_rule_files = [&](const RuleTrie& rule_trie, const Module& module, const ModuleTree& tree,
+                              const std::string& part, const std::string& rel, const std::string& path_str) -> size_t {
+        if (!index_covers(tree, part)) return 0;
+        long dir = tree.find(part + "/" + rel);
+        if (dir < 0) return 0;
+        const auto& entries = tree.entries();
+
+        // Cheap rejections first: most module directories exist on the system
+        std::string vpath = resolve_path_for_hymofs(path_str);
+        if (!stock.absent(vpath)) {
+            struct stat st;
+            if (!(entries[dir].flags & TreeEntry::REPLACE) || lstat(vpath.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+                return 0;
+            }
+        }
+        if (plan.has_overlay_at_or_below(vpath)) return 0;
+        for (const auto& path : configured_hides) {
+            if (at_or_below(path, vpath)) return 0;
+        }
+
+        // Only files and symlinks: whiteouts and devices would show up as such
+        size_t files = 0;
+        for (uint32_t i = dir + 1; i < entries[dir].end; i++) {
+            if (S_ISREG(entries[i].mode) || S_ISLNK(entries[i].mode)) {
+                files++;
+            } else if (!entries[i].is_dir()) {
+                return 0;
+            }
+        }
+        if (files < 2) return 0;
+
+        if (rule_trie.any_at_or_below(path_str, [](const std::string& mode) { return mode != "hymofs" && mode != "auto"; })) {
+            return 0;
+        }
+        for (const auto& other : modules) {
+            if (other.id == module.id) continue;
+            const ModuleTree& other_tree = ModuleIndex::global().get(other.id, other.source_path);
+            if (index_covers(other_tree, part)) {
+                if (other_tree.find(part + "/" + rel) >= 0) return 0;
+            } else {
+                struct stat st;
+                if (lstat((storage_root / other.id / part / rel).c_str(), &st) == 0) return 0;
+            }
+        }
+
+        return files;
+    };
+
+    // Iterate in reverse (Lowest Priority -> Highest Priority), the merger keeps the last
     for (auto it = modules.rbegin(); it != modules.rend(); ++it) {
         const auto& module = *it;
         
@@ -334,87 +562,184 @@ void update_hymofs_mappings(
         if (!is_hymofs) continue;
 
         fs::path mod_path = storage_root / module.id;
+        const ModuleTree& tree = ModuleIndex::global().get(module.id, module.source_path);
+        RuleTrie rule_trie(module.rules);
         
         // Determine default mode for this module
         std::string default_mode = module.mode;
         if (default_mode == "auto") default_mode = "hymofs"; // If it's in hymofs_module_ids, default is effectively hymofs unless overridden
 
+        size_t rules_before = merger.size();
+        size_t compacted_dirs = 0;
+        size_t compacted_files = 0;
+
         for (const auto& part : target_partitions) {
             fs::path part_root = mod_path / part;
             if (!fs::exists(part_root)) continue;
 
-            try {
-                for (const auto& entry : fs::recursive_directory_iterator(part_root)) {
-                    fs::path rel = fs::relative(entry.path(), mod_path);
-                    fs::path virtual_path = fs::path("/") / rel;
-                    std::string path_str = virtual_path.string();
-
-                    // Check rules
-                    std::string mode = default_mode;
-                    size_t max_len = 0;
-                    for (const auto& rule : module.rules) {
-                        if (path_str == rule.path || 
-                           (path_str.size() > rule.path.size() && path_str.compare(0, rule.path.size(), rule.path) == 0 && path_str[rule.path.size()] == '/')) {
-                            if (rule.path.size() > max_len) {
-                                max_len = rule.path.size();
-                                mode = rule.mode;
-                            }
-                        }
-                    }
+            std::error_code ec = visit_partition(tree, mod_path, part, [&](const std::string& rel, const struct stat& st) {
+                std::string path_str = "/" + part + "/" + rel;
 
-                    // If mode is NOT hymofs, skip this file
-                    if (mode != "hymofs" && mode != "auto") {
-                        continue;
-                    }
-                    
-                    if (plan.is_covered_by_overlay(virtual_path.string())) {
-                        continue;
+                // Check rules
+                RuleTrie::Match match = rule_trie.match(path_str);
+                const std::string& mode = match.mode ? *match.mode : default_mode;
+
+                // Exact overlay/magic rule directories were segregated out of the mirror
+                // (the index still lists them), so nothing below them maps through HymoFS
+                if (S_ISDIR(st.st_mode) && (match.exact_has("overlay") || match.exact_has("magic"))) {
+                    return WalkAction::SkipSubtree;
+                }
+
+                // If mode is NOT hymofs, skip this file
+                if (mode != "hymofs" && mode != "auto") {
+                    return WalkAction::Continue;
+                }
+                
+                if (plan.is_covered_by_overlay(path_str)) {
+                    return WalkAction::Continue;
+                }
+
+                if (compact && S_ISDIR(st.st_mode) && !rel.empty()) {
+                    if (size_t files = dir_rule_files(rule_trie, module, tree, part, rel, path_str)) {
+                        merger.add(module.id, {resolve_path_for_hymofs(path_str), (part_root / rel).string(), DT_DIR});
+                        compacted_dirs++;
+                        compacted_files += files;
+                        return WalkAction::SkipSubtree;
                     }
-                    
-                    if (entry.is_regular_file() || entry.is_symlink()) {
-                        // Safety Check: Do not replace existing directories with symlinks
-                        if (entry.is_symlink()) {
-                            if (fs::exists(virtual_path) && fs::is_directory(virtual_path)) {
-                                LOG_WARN("Safety: Skipping symlink replacement for directory: " + virtual_path.string());
-                                continue;
-                            }
-                        }
-                        int type = DT_UNKNOWN;
-                        if (entry.is_regular_file()) type = DT_REG;
-                        else if (entry.is_symlink()) type = DT_LNK;
-                        else if (entry.is_directory()) type = DT_DIR;
-                        else if (entry.is_block_file()) type = DT_BLK;
-                        else if (entry.is_character_file()) type = DT_CHR;
-                        else if (entry.is_fifo()) type = DT_FIFO;
-                        else if (entry.is_socket()) type = DT_SOCK;
-
-                        std::string final_virtual_path = resolve_path_for_hymofs(virtual_path.string());
-                        add_rules.push_back({final_virtual_path, entry.path().string(), type});
-                    } else if (entry.is_character_file()) {
-                        // Check for whiteout (0:0)
-                        struct stat st;
-                        if (stat(entry.path().c_str(), &st) == 0) {
-                            if (major(st.st_rdev) == 0 && minor(st.st_rdev) == 0) {
-                                hide_rules.push_back(resolve_path_for_hymofs(virtual_path.string()));
-                            }
+                }
+                
+                if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
+                    // Safety Check: Do not replace existing directories with symlinks
+                    if (S_ISLNK(st.st_mode)) {
+                        std::error_code dir_ec;
+                        if (fs::is_directory(path_str, dir_ec)) {
+                            LOG_WARN("Safety: Skipping symlink replacement for directory: " + path_str);
+                            return WalkAction::Continue;
                         }
                     }
+                    int type = S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+
+                    std::string final_virtual_path = resolve_path_for_hymofs(path_str);
+                    merger.add(module.id, {final_virtual_path, (part_root / rel).string(), type});
+                } else if (S_ISCHR(st.st_mode) && major(st.st_rdev) == 0 && minor(st.st_rdev) == 0) {
+                    // Whiteout (0:0)
+                    merger.hide(module.id, resolve_path_for_hymofs(path_str), false);
                 }
-            } catch (const std::exception& e) {
-                LOG_WARN("Error scanning module " + module.id + ": " + std::string(e.what()));
+                return WalkAction::Continue;
+            });
+            if (ec) {
+                LOG_WARN("Error scanning module " + module.id + ": " + ec.message());
             }
         }
+
+        if (compacted_dirs > 0) {
+            size_t rules_after = merger.size() - rules_before;
+            LOG_INFO("HymoFS compaction: " + module.id + ": " + std::to_string(rules_after + compacted_files - compacted_dirs) +
+                     " rules -> " + std::to_string(rules_after) + " (" + std::to_string(compacted_dirs) +
+                     " directories)");
+        }
     }
-    
-    // Apply rules: Add files first (auto-injects parents), then hide
-    for (const auto& rule : add_rules) {
-        HymoFS::add_rule(rule.src, rule.target, rule.type);
+
+    LOG_DEBUG("Path resolver: " + std::to_string(PathResolver::global().cached()) + " paths cached, " +
+              std::to_string(PathResolver::global().lookups()) + " lookups");
+
+    HymoRules rules = merger.finish(report);
+    if (merger.size() > rules.add_rules.size() + rules.hide_rules.size()) {
+        LOG_INFO("HymoFS: " + std::to_string(merger.size()) + " module rules -> " +
+                 std::to_string(rules.add_rules.size() + rules.hide_rules.size()) + " after resolving overrides");
     }
-    for (const auto& path : hide_rules) {
-        HymoFS::hide_path(path);
+    return rules;
+}
+
+// Send only what differs between the applied and the wanted rules. A delete drops
+// every rule on its path, so all wanted rules on a deleted path are sent again.
+static void apply_rule_diff(HymoFSSession& session, const HymoRules& have, const HymoRules& want) {
+    // Later adds for the same path replace earlier ones
+    std::map<std::string, std::pair<std::string, int>> have_add, want_add;
+    for (const auto& r : have.add_rules) have_add[r.src] = {r.target, r.type};
+    for (const auto& r : want.add_rules) want_add[r.src] = {r.target, r.type};
+    std::set<std::string> have_hide(have.hide_rules.begin(), have.hide_rules.end());
+    std::set<std::string> want_hide(want.hide_rules.begin(), want.hide_rules.end());
+
+    std::set<std::string> deleted;
+    for (const auto& [src, value] : have_add) {
+        auto it = want_add.find(src);
+        if (it == want_add.end() || it->second != value) deleted.insert(src);
+    }
+    for (const auto& path : have_hide) {
+        if (!want_hide.count(path)) deleted.insert(path);
+    }
+
+    size_t added = 0;
+    for (const auto& path : deleted) {
+        session.delete_rule(path);
+    }
+    for (const auto& rule : want.add_rules) {
+        if (deleted.count(rule.src) || !have_add.count(rule.src)) {
+            session.add_rule(rule.src, rule.target, rule.type);
+            added++;
+        }
+    }
+    for (const auto& path : want.hide_rules) {
+        if (deleted.count(path) || !have_hide.count(path)) {
+            session.hide_path(path);
+            added++;
+        }
+    }
+    LOG_INFO("HymoFS: " + std::to_string(added) + " rules added, " +
+             std::to_string(deleted.size()) + " deleted, the rest kept in place");
+}
+
+void apply_hymofs_rules(const HymoRules& rules) {
+    if (!HymoFS::is_available()) return;
+
+    // The record must describe what is in the kernel: no other hymod in between
+    FileLock lock(HYMOFS_LOCK_FILE);
+    HymoFSSession session;
+    if (!session.is_open()) {
+        LOG_ERROR("Failed to open HymoFS control device");
+        return;
+    }
+
+    HymoRules applied;
+    if (load_applied_rules(applied)) {
+        apply_rule_diff(session, applied, rules);
+    } else {
+        // Clear existing mappings
+        session.clear();
+
+        // Apply rules: Add files first (auto-injects parents), then hide
+        for (const auto& rule : rules.add_rules) {
+            session.add_rule(rule.src, rule.target, rule.type);
+        }
+        for (const auto& path : rules.hide_rules) {
+            session.hide_path(path);
+        }
+    }
+    // Whatever failed is not in the kernel; don't let the record claim otherwise
+    if (session.flush() && session.failures() == 0) {
+        save_applied_rules(rules);
+    } else {
+        forget_applied_rules();
     }
     
+    LOG_DEBUG("HymoFS: " + std::to_string(session.records()) + " rules in " + std::to_string(session.ioctls()) +
+              " ioctls (" + (session.batching() ? "batched" : "single") + "), " +
+              std::to_string(session.failures()) + " rejected");
     LOG_INFO("HymoFS mappings updated.");
 }
 
+void update_hymofs_mappings(
+    const Config& config,
+    const std::vector<Module>& modules,
+    const fs::path& storage_root,
+    const MountPlan& plan
+) {
+    if (!HymoFS::is_available()) return;
+    FileLock lock(HYMOFS_LOCK_FILE);
+    HymoConflictReport report;
+    apply_hymofs_rules(build_hymofs_rules(config, modules, storage_root, plan, &report));
+    save_conflict_report(report);
+}
+
 } // namespace hymo
@@ -2,9 +2,11 @@
 #pragma once
 
 #include "inventory.hpp"
+#include "path_index.hpp"
 #include "../conf/config.hpp"
 #include <vector>
 #include <map>
+#include <set>
 #include <filesystem>
 
 namespace fs = std::filesystem;
@@ -23,7 +25,17 @@ struct MountPlan {
     std::vector<std::string> magic_module_ids;
     std::vector<std::string> hymofs_module_ids;
 
+    // Targets of overlay_ops, for coverage queries. Rebuild with index_targets() after
+    // changing overlay_ops; until then queries scan overlay_ops instead.
+    PathIndex overlay_targets;
+    void index_targets();
+
     bool is_covered_by_overlay(const std::string& path) const;
+    // Whether an overlay target is dir or lies below it
+    bool has_overlay_at_or_below(const std::string& dir) const;
+
+private:
+    size_t indexed_ops_ = 0;
 };
 
 MountPlan generate_plan(
@@ -32,6 +44,57 @@ MountPlan generate_plan(
     const fs::path& storage_root
 );
 
+struct HymoAddRule {
+    std::string src;    // virtual path
+    std::string target; // file or directory in storage backing it
+    int type;           // DT_REG, DT_LNK or DT_DIR (whole directory, see compact_rules)
+};
+
+// "reg", "lnk" or "dir" as used by the rule records, and back (-1 if unknown)
+const char* rule_type_name(int type);
+int rule_type_from_name(const std::string& name);
+
+struct HymoRules {
+    std::vector<HymoAddRule> add_rules;
+    std::vector<std::string> hide_rules;
+    // Virtual path -> module its rule came from (not every rule has one)
+    std::map<std::string, std::string> owners;
+
+    // The rules module contributed
+    HymoRules of_module(const std::string& module) const;
+    // Drop the rules on these paths
+    void erase(const std::set<std::string>& paths);
+};
+
+// A path more than one HymoFS module provides
+struct HymoConflict {
+    std::string path;                  // virtual path
+    std::string winner;                // module whose rule is applied
+    std::vector<std::string> shadowed; // modules it overrides, highest priority first
+};
+
+struct HymoConflictReport {
+    std::vector<HymoConflict> conflicts;    // sorted by path
+    std::map<std::string, size_t> provided; // module id -> paths it has rules for
+};
+
+// Rules for the plan's HymoFS modules, without touching the kernel: one per path,
+// from the highest-priority module providing it (a configured hide always wins).
+// Which module shadowed which goes to report if given.
+HymoRules build_hymofs_rules(
+    const Config& config,
+    const std::vector<Module>& modules,
+    const fs::path& storage_root,
+    const MountPlan& plan,
+    HymoConflictReport* report = nullptr
+);
+
+// Make the kernel's mappings equal to rules. When the rules applied earlier in this
+// boot are on record, only the difference is sent and unchanged rules stay in
+// place throughout; otherwise the kernel is cleared and everything re-added.
+void apply_hymofs_rules(const HymoRules& rules);
+
+// build_hymofs_rules() + apply_hymofs_rules(), saving the conflict report
 void update_hymofs_mappings(
     const Config& config,
     const std::vector<Module>& modules,
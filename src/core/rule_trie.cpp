@@ -0,0 +1,106 @@
+// core/rule_trie.cpp - A module's mount rules by path component implementation
+#include "rule_trie.hpp"
+
+namespace hymo {
+
+// Components of path split at every '/', empty ones included: "/a/b" is "", "a", "b".
+// That keeps matching identical to comparing the strings: "/a/" covers only "/a/".
+template <typename Fn>
+static void for_each_component(std::string_view path, Fn&& fn) {
+    size_t start = 0;
+    for (;;) {
+        size_t slash = path.find('/', start);
+        if (!fn(path.substr(start, slash == std::string_view::npos ? std::string_view::npos : slash - start))) return;
+        if (slash == std::string_view::npos) return;
+        start = slash + 1;
+    }
+}
+
+bool RuleTrie::Match::exact_has(const std::string& m) const {
+    if (!exact_modes) return false;
+    for (const auto& mode : *exact_modes) {
+        if (mode == m) return true;
+    }
+    return false;
+}
+
+RuleTrie::RuleTrie(const std::vector<ModuleRule>& rules) {
+    for (const auto& rule : rules) {
+        // An empty path never matched anything in the old linear scan either
+        if (rule.path.empty()) continue;
+        uint32_t node = 0;
+        for_each_component(rule.path, [&](std::string_view name) {
+            auto it = nodes_[node].children.find(name);
+            if (it == nodes_[node].children.end()) {
+                uint32_t child = nodes_.size();
+                nodes_[node].children.emplace(std::string(name), child);
+                nodes_.emplace_back();
+                node = child;
+            } else {
+                node = it->second;
+            }
+            return true;
+        });
+        nodes_[node].modes.push_back(rule.mode);
+        rule_count_++;
+    }
+}
+
+RuleTrie::Match RuleTrie::match(std::string_view path) const {
+    Match result;
+    if (rule_count_ == 0) return result;
+
+    uint32_t node = 0;
+    bool whole = true;
+    for_each_component(path, [&](std::string_view name) {
+        auto it = nodes_[node].children.find(name);
+        if (it == nodes_[node].children.end()) {
+            whole = false;
+            return false;
+        }
+        node = it->second;
+        if (!nodes_[node].modes.empty()) {
+            result.mode = &nodes_[node].modes.front();
+            result.exact = false;
+            result.exact_modes = nullptr;
+        }
+        return true;
+    });
+    // Only a rule on the last component is exact
+    if (whole && !nodes_[node].modes.empty()) {
+        result.exact = true;
+        result.exact_modes = &nodes_[node].modes;
+    }
+    return result;
+}
+
+long RuleTrie::find(std::string_view path) const {
+    long node = 0;
+    for_each_component(path, [&](std::string_view name) {
+        auto it = nodes_[node].children.find(name);
+        node = it == nodes_[node].children.end() ? -1 : (long)it->second;
+        return node >= 0;
+    });
+    return node;
+}
+
+bool RuleTrie::any_at_or_below(std::string_view path, const std::function<bool(const std::string&)>& fn) const {
+    if (rule_count_ == 0) return false;
+    long start = find(path);
+    if (start < 0) return false;
+
+    std::vector<uint32_t> stack = {(uint32_t)start};
+    while (!stack.empty()) {
+        const Node& node = nodes_[stack.back()];
+        stack.pop_back();
+        for (const auto& mode : node.modes) {
+            if (fn(mode)) return true;
+        }
+        for (const auto& [name, child] : node.children) {
+            stack.push_back(child);
+        }
+    }
+    return false;
+}
+
+} // namespace hymo
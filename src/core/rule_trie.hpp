@@ -0,0 +1,47 @@
+// core/rule_trie.hpp - A module's mount rules by path component
+#pragma once
+
+#include "inventory.hpp"
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+namespace hymo {
+
+// A module's rules compiled once, so the rule for a path is found in one walk down
+// its components instead of a scan over every rule. A rule covers its own path and
+// everything below it ("/system/app" covers "/system/app/x" but not "/system/apps").
+class RuleTrie {
+public:
+    struct Match {
+        const std::string* mode = nullptr; // mode of the longest covering rule, nullptr if none
+        bool exact = false;                // that rule's path is the path itself
+        // Modes of all rules on exactly this path (in rule order); nullptr if none
+        const std::vector<std::string>* exact_modes = nullptr;
+
+        bool exact_has(const std::string& m) const;
+    };
+
+    RuleTrie() = default;
+    explicit RuleTrie(const std::vector<ModuleRule>& rules);
+
+    bool empty() const { return rule_count_ == 0; }
+    Match match(std::string_view path) const;
+    // Whether fn is true for the mode of some rule on path or below it
+    bool any_at_or_below(std::string_view path, const std::function<bool(const std::string&)>& fn) const;
+
+private:
+    struct Node {
+        std::map<std::string, uint32_t, std::less<>> children;
+        std::vector<std::string> modes; // rules ending here, the first one applies
+    };
+
+    long find(std::string_view path) const;
+
+    std::vector<Node> nodes_{1};
+    size_t rule_count_ = 0;
+};
+
+} // namespace hymo
@@ -1,17 +1,30 @@
 // core/storage.cpp - Storage backend implementation (FIXED)
 #include "storage.hpp"
 #include "state.hpp"
+#include "dedup.hpp"
 #include "../defs.hpp"
 #include "../utils.hpp"
 #include <iostream>
 #include <cstring>
 #include <cstdio>
-#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/loop.h>
+#include <linux/magic.h>
+#include <linux/major.h>
+#include <sys/sysmacros.h>
+#include <fstream>
+#include <fcntl.h>
+#include <algorithm>
 #include <sys/mount.h>
 #include <sys/vfs.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifndef EXT4_IOC_RESIZE_FS
+#define EXT4_IOC_RESIZE_FS _IOW('f', 16, uint64_t)
+#endif
+
 namespace hymo {
 
 static bool try_setup_tmpfs(const fs::path& target) {
@@ -58,44 +71,95 @@ static void repair_storage_root_permissions(const fs::path& target) {
     }
 }
 
-static bool create_image(const fs::path& base_dir) {
-    LOG_INFO("Creating modules.img...");
-    fs::path script = base_dir / "createimg.sh";
-    if (!fs::exists(script)) {
-        LOG_ERROR("createimg.sh not found at " + script.string());
+// Content plus 50% headroom for module updates, never below IMAGE_MIN_SIZE_MB
+static uint64_t image_size_for(uint64_t content_bytes) {
+    const uint64_t MB = 1024 * 1024;
+    uint64_t size = content_bytes + content_bytes / 2 + 32 * MB;
+    size = std::max<uint64_t>(size, IMAGE_MIN_SIZE_MB * MB);
+    return (size + 16 * MB - 1) / (16 * MB) * (16 * MB);
+}
+
+// Reserve the image's blocks without writing them. F2FS-backed loop devices
+// misbehave on sparse files on some devices, so a sparse file is only the fallback.
+static bool allocate_image_file(const fs::path& image_path, uint64_t size) {
+    int fd = open(image_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create " + image_path.string() + ": " + strerror(errno));
         return false;
     }
     
-    // Capture output to debug creation issues
-    std::string cmd = "sh " + script.string() + " " + base_dir.string() + " 2048 2>&1";
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
-        LOG_ERROR("Failed to execute createimg.sh");
+    // Same as chattr -c: F2FS compression breaks loop devices
+    int flags = 0;
+    if (ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0 && (flags & FS_COMPR_FL)) {
+        flags &= ~FS_COMPR_FL;
+        ioctl(fd, FS_IOC_SETFLAGS, &flags);
+    }
+    
+    bool ok = true;
+    if (fallocate(fd, 0, 0, size) != 0) {
+        if (errno == EOPNOTSUPP || errno == ENOSYS) {
+            LOG_WARN("fallocate not supported, creating sparse image");
+            ok = ftruncate(fd, size) == 0;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        LOG_ERROR("Failed to allocate " + image_path.string() + ": " + strerror(errno));
+    }
+    close(fd);
+    return ok;
+}
+
+static bool format_image(const fs::path& image_path, bool journal) {
+    std::string mke2fs = find_executable({"/system/bin/mke2fs", "/sbin/mke2fs", "/system/xbin/mke2fs",
+                                          "/usr/sbin/mke2fs", "/sbin/mkfs.ext4", "/usr/sbin/mkfs.ext4"});
+    if (mke2fs.empty()) {
+        LOG_ERROR("mke2fs not found");
         return false;
     }
     
-    char buffer[256];
-    std::string output = "";
-    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        output += buffer;
+    // No metadata_csum/64bit for older kernels; nodiscard keeps the allocation intact.
+    // Without a journal no jbd2 thread or sysfs node shows up for the image.
+    std::vector<std::string> argv = {
+        mke2fs, "-t", "ext4", "-F", "-q", "-m", "0", "-E", "nodiscard",
+        "-O", journal ? "^metadata_csum,^64bit" : "^has_journal,^metadata_csum,^64bit",
+        image_path.string()
+    };
+    std::string output;
+    int ret = run_command(argv, &output);
+    if (ret != 0) {
+        LOG_ERROR("Failed to format ext4 image (" + std::to_string(ret) + "): " + output);
+        return false;
     }
+    return true;
+}
+
+static bool create_image(const fs::path& image_path, const Config& config) {
+    uint64_t content = allocated_size_recursive(config.moduledir);
+    uint64_t size = image_size_for(content);
+    LOG_INFO("Creating " + std::to_string(size / (1024 * 1024)) + " MB modules.img for " +
+             std::to_string(content / (1024 * 1024)) + " MB of module content...");
     
-    int ret = pclose(pipe);
-    if (WEXITSTATUS(ret) != 0) {
-        LOG_ERROR("Failed to create image: " + output);
+    if (!ensure_dir_exists(image_path.parent_path()) || !allocate_image_file(image_path, size)) {
+        unlink(image_path.c_str());
+        return false;
+    }
+    if (!format_image(image_path, config.image_journal)) {
+        unlink(image_path.c_str());
         return false;
     }
     
-    LOG_INFO("Image creation output: " + output);
+    LOG_INFO("Image created successfully");
     return true;
 }
 
-static std::string setup_ext4_image(const fs::path& target, const fs::path& image_path) {
+static std::string setup_ext4_image(const fs::path& target, const fs::path& image_path, const Config& config) {
     LOG_DEBUG("Falling back to Ext4 Image mode...");
     
     if (!fs::exists(image_path)) {
         LOG_WARN("modules.img not found. Attempting to create it...");
-        if (!create_image(image_path.parent_path())) {
+        if (!create_image(image_path, config)) {
              throw std::runtime_error("Failed to create modules.img");
         }
     }
@@ -119,7 +183,8 @@ static std::string setup_ext4_image(const fs::path& target, const fs::path& imag
     return "ext4";
 }
 
-StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path, bool force_ext4) {
+StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path, const Config& config,
+                            const std::string& backend) {
     LOG_DEBUG("Setting up storage at " + mnt_dir.string());
     
     // Clean up previous mounts
@@ -128,16 +193,137 @@ StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path,
     }
     ensure_dir_exists(mnt_dir);
     
+    bool mounted_mirror = backend == "bind" || backend == "erofs";
     std::string mode;
-    if (!force_ext4 && try_setup_tmpfs(mnt_dir)) {
-        mode = "tmpfs";
+    if ((!config.force_ext4 || mounted_mirror) && try_setup_tmpfs(mnt_dir)) {
+        // Such a tmpfs only holds mount points plus modules that still need a copy
+        mode = mounted_mirror ? backend : "tmpfs";
     } else {
-        mode = setup_ext4_image(mnt_dir, image_path);
+        mode = setup_ext4_image(mnt_dir, image_path, config);
     }
     
     return StorageHandle{mnt_dir, mode};
 }
 
+// Loop device and backing image behind an ext4 mount point
+static bool find_image_backing(const fs::path& mount_point, std::string& loop_dev, fs::path& image) {
+    struct statfs sfs;
+    struct stat st;
+    if (statfs(mount_point.c_str(), &sfs) != 0 || sfs.f_type != EXT4_SUPER_MAGIC ||
+        stat(mount_point.c_str(), &st) != 0 || major(st.st_dev) != LOOP_MAJOR) {
+        return false;
+    }
+    
+    std::string sys_dir = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" +
+                          std::to_string(minor(st.st_dev));
+    std::ifstream backing(sys_dir + "/loop/backing_file");
+    std::string path;
+    if (!std::getline(backing, path) || path.empty()) {
+        return false;
+    }
+    image = path;
+    
+    // DEVNAME=loopN (minor != N when loop partitions are enabled)
+    std::ifstream uevent(sys_dir + "/uevent");
+    std::string name;
+    for (std::string line; std::getline(uevent, line);) {
+        if (line.rfind("DEVNAME=", 0) == 0) name = line.substr(8);
+    }
+    if (name.empty()) {
+        return false;
+    }
+    
+    for (const char* dir : {"/dev/block/", "/dev/"}) {
+        std::string dev = dir + name;
+        if (access(dev.c_str(), F_OK) == 0) {
+            loop_dev = dev;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool grow_storage(const fs::path& mount_point, uint64_t extra_bytes) {
+    std::string loop_dev;
+    fs::path image;
+    if (!find_image_backing(mount_point, loop_dev, image)) {
+        return false;
+    }
+    
+    struct statfs sfs;
+    struct stat img_st;
+    if (statfs(mount_point.c_str(), &sfs) != 0 || stat(image.c_str(), &img_st) != 0) {
+        return false;
+    }
+    
+    const uint64_t MB = 1024 * 1024;
+    uint64_t current = img_st.st_size;
+    uint64_t free_bytes = (uint64_t)sfs.f_bavail * sfs.f_bsize;
+    // Leave 10% slack on top of what was asked for, and grow by at least 64 MiB
+    uint64_t wanted_free = extra_bytes + current / 10;
+    uint64_t grow_by = wanted_free > free_bytes ? wanted_free - free_bytes : 0;
+    grow_by = std::max<uint64_t>(grow_by, IMAGE_MIN_SIZE_MB * MB);
+    uint64_t new_size = (current + grow_by + 16 * MB - 1) / (16 * MB) * (16 * MB);
+    
+    LOG_INFO("Growing " + image.string() + " from " + std::to_string(current / MB) + " MB to " +
+             std::to_string(new_size / MB) + " MB");
+    
+    int img_fd = open(image.c_str(), O_RDWR | O_CLOEXEC);
+    if (img_fd < 0) {
+        LOG_ERROR("Failed to open image for growing: " + std::string(strerror(errno)));
+        return false;
+    }
+    bool ok = fallocate(img_fd, 0, current, new_size - current) == 0 ||
+              ((errno == EOPNOTSUPP || errno == ENOSYS) && ftruncate(img_fd, new_size) == 0);
+    close(img_fd);
+    if (!ok) {
+        LOG_ERROR("Failed to extend image: " + std::string(strerror(errno)));
+        return false;
+    }
+    
+    int loop_fd = open(loop_dev.c_str(), O_RDONLY | O_CLOEXEC);
+    if (loop_fd < 0 || ioctl(loop_fd, LOOP_SET_CAPACITY, 0) != 0) {
+        LOG_ERROR("Failed to refresh loop capacity of " + loop_dev + ": " + strerror(errno));
+        if (loop_fd >= 0) close(loop_fd);
+        return false;
+    }
+    close(loop_fd);
+    
+    int dir_fd = open(mount_point.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    uint64_t blocks = new_size / sfs.f_bsize;
+    if (dir_fd < 0 || ioctl(dir_fd, EXT4_IOC_RESIZE_FS, &blocks) != 0) {
+        LOG_ERROR("Online resize of " + mount_point.string() + " failed: " + strerror(errno));
+        if (dir_fd >= 0) close(dir_fd);
+        return false;
+    }
+    close(dir_fd);
+    return true;
+}
+
+bool trim_storage(const fs::path& mount_point) {
+    std::string loop_dev;
+    fs::path image;
+    if (!find_image_backing(mount_point, loop_dev, image)) {
+        return false;
+    }
+    
+    int dir_fd = open(mount_point.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return false;
+    }
+    struct fstrim_range range = {};
+    range.len = UINT64_MAX;
+    bool ok = ioctl(dir_fd, FITRIM, &range) == 0;
+    close(dir_fd);
+    
+    if (ok) {
+        LOG_DEBUG("Trimmed " + std::to_string(range.len / (1024 * 1024)) + " MB from " + image.string());
+    } else {
+        LOG_DEBUG("FITRIM not supported on " + mount_point.string() + ": " + strerror(errno));
+    }
+    return ok;
+}
+
 // FIX 3: Add public function for main.cpp to call
 void finalize_storage_permissions(const fs::path& storage_root) {
     repair_storage_root_permissions(storage_root);
@@ -191,6 +377,7 @@ void print_storage_status() {
               << "\"used\": \"" << format_size(used_bytes) << "\", "
               << "\"avail\": \"" << format_size(free_bytes) << "\", "
               << "\"percent\": \"" << (int)percent << "%\", "
+              << "\"dedup_saved\": \"" << format_size(measure_dedup_store(path).bytes_saved) << "\", "
               << "\"type\": \"" << fs_type << "\" "
               << "}\n";
 }
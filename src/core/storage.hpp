@@ -3,6 +3,7 @@
 
 #include <string>
 #include <filesystem>
+#include "../conf/config.hpp"
 
 namespace fs = std::filesystem;
 
@@ -10,10 +11,23 @@ namespace hymo {
 
 struct StorageHandle {
     fs::path mount_point;
-    std::string mode; // "tmpfs" or "ext4"
+    std::string mode; // "tmpfs", "ext4", "bind" or "erofs"
 };
 
-StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path, bool force_ext4);
+// Uses force_ext4, and moduledir/image_journal when modules.img has to be created.
+// backend is the HymoFS mirror backend; leave it at "copy" for any other storage.
+// "bind" / "erofs": mount only a small tmpfs container whose module directories
+// are later bind mounted from the source or from per-module EROFS images instead
+// of copied; the handle's mode is then the backend name
+StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path, const Config& config,
+                            const std::string& backend = "copy");
+
+// Image-backed (ext4 on loop) storage only; no-ops returning false elsewhere.
+// Grow the image so at least extra_bytes are free: extend the file, refresh the
+// loop device capacity and resize the mounted filesystem online.
+bool grow_storage(const fs::path& mount_point, uint64_t extra_bytes);
+// Discard unused filesystem blocks so the loop device punches them out of the image
+bool trim_storage(const fs::path& mount_point);
 
 // New: Finalize storage permission repair (called after sync)
 void finalize_storage_permissions(const fs::path& storage_root);
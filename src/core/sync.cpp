@@ -1,56 +1,41 @@
 // core/sync.cpp - Module content synchronization implementation (FIXED)
 #include "sync.hpp"
+#include "manifest.hpp"
+#include "dedup.hpp"
+#include "labeler.hpp"
+#include "module_tree.hpp"
+#include "erofs.hpp"
+#include "storage.hpp"
 #include "../utils.hpp"
+#include "../copy_engine.hpp"
+#include "../io_ring.hpp"
 #include "../defs.hpp"
 #include <set>
 #include <fstream>
+#include <atomic>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/vfs.h>
 
 namespace hymo {
 
 // Helper: Check if module has content for any partition (builtin or extra)
-static bool has_content(const fs::path& module_path, const std::vector<std::string>& all_partitions) {
+static bool has_content(const Module& module, const std::vector<std::string>& all_partitions) {
+    const ModuleTree& tree = ModuleIndex::global().get(module.id, module.source_path);
     for (const auto& partition : all_partitions) {
-        fs::path part_path = module_path / partition;
-        if (has_files_recursive(part_path)) {
+        if (tree.has_files(partition)) {
             return true;
         }
     }
     return false;
 }
 
-// Helper: Check if module needs sync by comparing module.prop
-static bool should_sync(const fs::path& src, const fs::path& dst) {
-    if (!fs::exists(dst)) {
-        return true; // New module
-    }
-    
-    fs::path src_prop = src / "module.prop";
-    fs::path dst_prop = dst / "module.prop";
-    
-    if (!fs::exists(src_prop) || !fs::exists(dst_prop)) {
-        return true; // Missing prop file, force sync
-    }
-    
-    // Compare file content
-    try {
-        std::ifstream src_file(src_prop, std::ios::binary);
-        std::ifstream dst_file(dst_prop, std::ios::binary);
-        
-        std::string src_content((std::istreambuf_iterator<char>(src_file)),
-                                std::istreambuf_iterator<char>());
-        std::string dst_content((std::istreambuf_iterator<char>(dst_file)),
-                                std::istreambuf_iterator<char>());
-        
-        return src_content != dst_content;
-    } catch (...) {
-        return true; // Read error, force sync
-    }
-}
-
-// Helper: Remove orphaned module directories
-static void prune_orphaned_modules(const std::vector<Module>& modules, const fs::path& storage_root) {
+// Helper: Remove orphaned module directories; returns how many were pruned
+static size_t prune_orphaned_modules(const std::vector<Module>& modules, const fs::path& storage_root) {
+    size_t pruned = 0;
     if (!fs::exists(storage_root)) {
-        return;
+        return pruned;
     }
     
     // Build active module ID set
@@ -64,7 +49,8 @@ static void prune_orphaned_modules(const std::vector<Module>& modules, const fs:
             std::string name = entry.path().filename().string();
             
             // Skip internal directories
-            if (name == "lost+found" || name == "hymo") {
+            if (name == "lost+found" || name == "hymo" || name == SYNC_MANIFEST_DIR_NAME ||
+                name == DEDUP_STORE_DIR_NAME) {
                 continue;
             }
             
@@ -72,6 +58,8 @@ static void prune_orphaned_modules(const std::vector<Module>& modules, const fs:
                 LOG_INFO("Pruning orphaned module storage: " + name);
                 try {
                     fs::remove_all(entry.path());
+                    fs::remove(manifest_path(storage_root, name));
+                    pruned++;
                 } catch (const std::exception& e) {
                     LOG_WARN("Failed to remove orphan: " + name);
                 }
@@ -80,14 +68,11 @@ static void prune_orphaned_modules(const std::vector<Module>& modules, const fs:
     } catch (...) {
         LOG_WARN("Failed to prune orphaned modules");
     }
+    return pruned;
 }
 
 // Improve SELinux Context repair logic
-static void recursive_context_repair(const fs::path& base, const fs::path& current) {
-    if (!fs::exists(current)) {
-        return;
-    }
-    
+static void repair_path_context(const fs::path& base, const fs::path& current) {
     try {
         std::string file_name = current.filename().string();
         
@@ -103,40 +88,71 @@ static void recursive_context_repair(const fs::path& base, const fs::path& curre
                 }
             }
         } else {
-            // For normal files/directories, try to get context from system path
-            fs::path relative = fs::relative(current, base);
+            // For normal files/directories, label from file_contexts when it is available
+            fs::path relative = current.lexically_relative(base);
             fs::path system_path = fs::path("/") / relative;
             
+            const auto& labeler = FileContextLabeler::system();
+            struct stat st;
+            if (!labeler.empty() && lstat(current.c_str(), &st) == 0) {
+                std::string ctx = labeler.lookup(system_path.string(), st.st_mode);
+                if (!ctx.empty()) {
+                    lsetfilecon(current, ctx);
+                    return;
+                }
+            }
+            
+            // Otherwise try to get context from system path
             if (fs::exists(system_path)) {
                 copy_path_context(system_path, current);
             }
         }
-        
-        // Recursively process subdirectories
-        if (fs::is_directory(current)) {
-            for (const auto& entry : fs::directory_iterator(current)) {
-                recursive_context_repair(base, entry.path());
-            }
-        }
     } catch (const std::exception& e) {
         LOG_DEBUG("Context repair failed for " + current.string() + ": " + e.what());
     }
 }
 
-// Fix module SELinux Context
-static void repair_module_contexts(const fs::path& module_root, const std::string& module_id, const std::vector<std::string>& all_partitions) {
-    LOG_DEBUG("Repairing SELinux contexts for module: " + module_id);
+// Fix SELinux contexts of the entries a sync created or rewrote
+static void repair_module_contexts(
+    const fs::path& module_root,
+    const std::string& module_id,
+    const std::vector<fs::path>& changed,
+    const std::vector<std::string>& all_partitions
+) {
+    LOG_DEBUG("Repairing SELinux contexts for module: " + module_id + " (" + std::to_string(changed.size()) + " entries)");
     
-    for (const auto& partition : all_partitions) {
-        fs::path part_root = module_root / partition;
+    for (const auto& path : changed) {
+        fs::path rel = path.lexically_relative(module_root);
+        if (rel.empty()) continue;
         
-        if (fs::exists(part_root) && fs::is_directory(part_root)) {
-            try {
-                recursive_context_repair(module_root, part_root);
-            } catch (const std::exception& e) {
-                LOG_WARN("Context repair failed for " + module_id + "/" + partition + ": " + e.what());
-            }
+        // Only partition content is mounted; module.prop, scripts etc. keep the default label
+        std::string top = rel.begin()->string();
+        if (std::find(all_partitions.begin(), all_partitions.end(), top) == all_partitions.end()) {
+            continue;
         }
+        repair_path_context(module_root, path);
+    }
+}
+
+// A full ext4 image is the usual reason for sync failures: grow it online and
+// rerun the modules flagged in failed once. sync_one must update failed itself.
+static void retry_after_growing(const std::vector<Module>& modules, const std::vector<char>& failed,
+                                const fs::path& storage_root, int sync_threads,
+                                const std::function<void(size_t)>& sync_one) {
+    std::vector<size_t> retry;
+    uint64_t retry_bytes = 0;
+    for (size_t i = 0; i < modules.size(); ++i) {
+        if (failed[i]) {
+            retry.push_back(i);
+            retry_bytes += allocated_size_recursive(modules[i].source_path);
+        }
+    }
+    struct statfs sfs;
+    if (!retry.empty() && statfs(storage_root.c_str(), &sfs) == 0 &&
+        (uint64_t)sfs.f_bavail * sfs.f_bsize < retry_bytes && grow_storage(storage_root, retry_bytes)) {
+        LOG_INFO("Retrying " + std::to_string(retry.size()) + " modules after growing storage");
+        run_parallel(retry.size(), resolve_worker_count(sync_threads, retry.size()),
+                     [&](size_t k) { sync_one(retry[k]); });
     }
 }
 
@@ -149,43 +165,295 @@ void perform_sync(const std::vector<Module>& modules, const fs::path& storage_ro
         all_partitions.push_back(part);
     }
     
+    set_copy_strategy(parse_copy_strategy(config.copy_strategy));
+    set_io_backend(parse_io_backend(config.io_backend));
+    reset_copy_stats();
+    reset_io_ring_stats();
+    
     // 1. Prune orphaned directories (clean disabled/removed modules)
-    prune_orphaned_modules(modules, storage_root);
+    size_t pruned = prune_orphaned_modules(modules, storage_root);
     
-    // 2. Sync each module
-    for (const auto& module : modules) {
+    // 2. Sync modules concurrently (each module owns its own dst subtree)
+    unsigned int workers = resolve_worker_count(config.sync_threads, modules.size());
+    LOG_DEBUG("Syncing " + std::to_string(modules.size()) + " modules with " + std::to_string(workers) + " workers");
+    
+    std::vector<char> synced(modules.size(), 0);
+    std::vector<char> failed(modules.size(), 0);
+    std::atomic<uint64_t> rewritten{0}; // removed or replaced entries, i.e. freed blocks
+    auto sync_one = [&](size_t i) {
+        const auto& module = modules[i];
         fs::path dst = storage_root / module.id;
         
         // Check if module has actual content for any partition (including extra partitions)
-        if (!has_content(module.source_path, all_partitions)) {
+        if (!has_content(module, all_partitions)) {
             LOG_DEBUG("Skipping empty module: " + module.id);
-            continue;
+            return;
         }
+        synced[i] = 1;
+        failed[i] = 0;
         
-        if (should_sync(module.source_path, dst)) {
-            LOG_DEBUG("Syncing module: " + module.id + " (Updated/New)");
+        SyncStats stats;
+        bool ok = sync_module_incremental(module.source_path, dst, manifest_path(storage_root, module.id), config.sync_hash,
+                                          &stats, &ModuleIndex::global().get(module.id, module.source_path));
+        rewritten += stats.removed + stats.copied;
+        if (!ok) {
+            LOG_ERROR("Failed to sync module " + module.id);
+            failed[i] = 1;
+        } else if (stats.changed.empty() && stats.removed == 0) {
+            LOG_DEBUG("Skipping module: " + module.id + " (Up-to-date)");
+        } else {
+            LOG_DEBUG("Synced module: " + module.id + " (" + std::to_string(stats.copied) + " updated, " +
+                      std::to_string(stats.removed) + " removed, " + std::to_string(stats.unchanged) + " unchanged)");
+            // Fix SELinux Context immediately after successful sync
+            repair_module_contexts(dst, module.id, stats.changed, all_partitions);
+        }
+    };
+    run_parallel(modules.size(), workers, sync_one);
+    retry_after_growing(modules, failed, storage_root, config.sync_threads, sync_one);
+    
+    // 3. Share identical payloads (runs after context repair: labels are part of the key)
+    uint64_t linked = 0;
+    if (config.enable_dedup) {
+        std::vector<std::string> ids;
+        for (size_t i = 0; i < modules.size(); ++i) {
+            if (synced[i]) ids.push_back(modules[i].id);
+        }
+        linked = dedup_storage(storage_root, ids, config.sync_threads).files_linked;
+    }
+    
+    // 4. Hand blocks freed by pruning, rewrites and dedup back to /data. Off by
+    // default: it punches holes in modules.img, which is fully allocated on purpose.
+    if (config.trim_image && (pruned > 0 || rewritten > 0 || linked > 0)) {
+        trim_storage(storage_root);
+    }
+    
+    LOG_INFO("Module sync completed. Copy: " + format_copy_stats(get_copy_stats()));
+    LOG_DEBUG("io_uring: " + format_io_ring_stats(get_io_ring_stats()));
+}
+
+void reset_mirror_staging(const fs::path& mirror_root) {
+    fs::path staging = mirror_root / OVERLAY_STAGING_DIR_NAME;
+    std::error_code ec;
+    if (!fs::exists(staging, ec)) {
+        return;
+    }
+    
+    for (const auto& entry : fs::directory_iterator(staging, ec)) {
+        fs::remove(manifest_path(mirror_root, entry.path().filename().string()), ec);
+    }
+    fs::remove_all(staging, ec);
+    if (ec) {
+        LOG_WARN("Failed to clean mirror staging: " + ec.message());
+    }
+}
+
+// Overlay/Magic sources get moved out of the mirror tree, which a read-only bind can't do
+static bool needs_segregation(const Module& mod) {
+    if (mod.mode == "overlay" || mod.mode == "magic") {
+        return true;
+    }
+    for (const auto& rule : mod.rules) {
+        if (rule.mode == "overlay" || rule.mode == "magic") {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string strip_context(std::string ctx) {
+    while (!ctx.empty() && ctx.back() == '\0') ctx.pop_back();
+    return ctx;
+}
+
+// A bind exposes the source labels as they are. Accept it only if every partition
+// entry already carries the label a copy would get (file_contexts or the default)
+static bool bind_labels_usable(const Module& mod, const fs::path& src, const std::vector<std::string>& partitions) {
+    const auto& labeler = FileContextLabeler::system();
+    const ModuleTree& tree = ModuleIndex::global().get(mod.id, src);
+    if (!tree.complete()) return false;
+    
+    for (const auto& part : partitions) {
+        auto [begin, end] = tree.subtree(part);
+        for (uint32_t i = begin; i < end; ++i) {
+            const TreeEntry& entry = tree.entries()[i];
+            fs::path path = src / entry.rel;
+            std::string actual = strip_context(lgetfilecon(path));
+            if (actual == DEFAULT_SELINUX_CONTEXT) continue;
             
-            // Clean target directory before sync
-            if (fs::exists(dst)) {
-                try {
-                    fs::remove_all(dst);
-                } catch (const std::exception& e) {
-                    LOG_WARN("Failed to clean target dir for " + module.id);
-                }
+            std::string expected = labeler.empty() ? "" : labeler.lookup("/" + entry.rel, entry.mode);
+            if (expected.empty() || actual != expected) {
+                LOG_DEBUG("Bind mirror: " + path.string() + " is labeled " + actual);
+                return false;
             }
-            
-            if (!sync_dir(module.source_path, dst)) {
-                LOG_ERROR("Failed to sync module " + module.id);
-            } else {
-                // Fix SELinux Context immediately after successful sync
-                repair_module_contexts(dst, module.id, all_partitions);
+        }
+    }
+    return true;
+}
+
+// Bind one module into the mirror; false means it has to be copied instead
+static bool bind_module_to_mirror(const Module& mod, const fs::path& src, const fs::path& dst,
+                                  const fs::path& mirror_root, const std::vector<std::string>& partitions) {
+    if (needs_segregation(mod) || !bind_labels_usable(mod, src, partitions)) {
+        return false;
+    }
+    if (is_mount_point(dst)) {
+        return true; // Bound on an earlier run; the source is live
+    }
+    
+    // Drop a copy left from before the module became bindable
+    std::error_code ec;
+    fs::remove_all(dst, ec);
+    fs::remove(manifest_path(mirror_root, mod.id), ec);
+    return bind_mount_readonly(src, dst);
+}
+
+// Label an image entry the way a copy would end up: file_contexts, else the default
+static std::string erofs_label(const fs::path& rel, mode_t mode) {
+    const auto& labeler = FileContextLabeler::system();
+    std::string ctx = labeler.empty() ? "" : labeler.lookup(rel.string(), mode);
+    return ctx.empty() ? DEFAULT_SELINUX_CONTEXT : ctx;
+}
+
+// Mount the module's EROFS image into the mirror, rebuilding it only if the
+// module changed; false means it has to be copied instead
+static bool erofs_module_to_mirror(const Module& mod, const fs::path& src, const fs::path& dst,
+                                   const fs::path& mirror_root) {
+    if (needs_segregation(mod)) {
+        return false;
+    }
+    
+    fs::path image = fs::path(EROFS_IMAGE_DIR) / (mod.id + ".img");
+    uint64_t stamp = erofs_tree_stamp(src, erofs_label);
+    uint64_t image_stamp = 0;
+    bool current = stamp != 0 && read_erofs_stamp(image, image_stamp) && image_stamp == stamp;
+    
+    if (current && is_mount_point(dst)) {
+        return true;
+    }
+    if (!current) {
+        ErofsImageInfo info;
+        if (!ensure_dir_exists(EROFS_IMAGE_DIR) || !build_erofs_image(src, image, erofs_label, &info)) {
+            return false;
+        }
+        LOG_DEBUG("Built EROFS image for " + mod.id + ": " + std::to_string(info.inodes) + " inodes, " +
+                  std::to_string(info.blocks * 4) + " KiB");
+    }
+    
+    if (is_mount_point(dst)) {
+        umount2(dst.c_str(), MNT_DETACH);
+    }
+    std::error_code ec;
+    fs::remove_all(dst, ec);
+    fs::remove(manifest_path(mirror_root, mod.id), ec);
+    return mount_erofs_image(image, dst);
+}
+
+// Remove images of modules that are no longer mirrored
+static void prune_erofs_images(const std::vector<Module>& modules) {
+    std::set<std::string> active;
+    for (const auto& mod : modules) active.insert(mod.id + ".img");
+    
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(EROFS_IMAGE_DIR, ec)) {
+        if (!active.count(entry.path().filename().string())) {
+            LOG_INFO("Pruning EROFS image: " + entry.path().filename().string());
+            fs::remove(entry.path(), ec);
+        }
+    }
+}
+
+bool sync_modules_to_mirror(const std::vector<Module>& modules, const fs::path& mirror_root, const Config& config,
+                            const std::string& storage_mode, bool partial) {
+    bool bind = storage_mode == "bind";
+    bool erofs = storage_mode == "erofs";
+    unsigned int workers = resolve_worker_count(config.sync_threads, modules.size());
+    LOG_DEBUG("Mirroring " + std::to_string(modules.size()) + " modules with " + std::to_string(workers) + " workers");
+    
+    set_copy_strategy(parse_copy_strategy(config.copy_strategy));
+    set_io_backend(parse_io_backend(config.io_backend));
+    reset_copy_stats();
+    reset_io_ring_stats();
+    
+    std::vector<std::string> all_partitions = BUILTIN_PARTITIONS;
+    for (const auto& part : config.partitions) {
+        all_partitions.push_back(part);
+    }
+    
+    std::vector<char> failed(modules.size(), 0);
+    std::vector<char> mounted(modules.size(), 0);
+    auto sync_one = [&](size_t i) {
+        const auto& mod = modules[i];
+        failed[i] = 0;
+        fs::path src = config.moduledir / mod.id;
+        fs::path dst = mirror_root / mod.id;
+        fs::path manifest = manifest_path(mirror_root, mod.id);
+        
+        if (bind || erofs) {
+            bool attached = bind ? bind_module_to_mirror(mod, src, dst, mirror_root, all_partitions)
+                                 : erofs_module_to_mirror(mod, src, dst, mirror_root);
+            if (attached) {
+                mounted[i] = 1;
+                return;
+            }
+            LOG_INFO(storage_mode + " mirror not usable for " + mod.id + ", copying");
+            if (is_mount_point(dst)) {
+                umount2(dst.c_str(), MNT_DETACH);
             }
-        } else {
-            LOG_DEBUG("Skipping module: " + module.id + " (Up-to-date)");
         }
+        
+        // Content segregated out of this module's tree for Overlay/Magic rules is
+        // missing from dst, so its manifest no longer describes it
+        std::error_code ec;
+        if (fs::exists(mirror_root / OVERLAY_STAGING_DIR_NAME / mod.id, ec)) {
+            fs::remove(manifest, ec);
+        }
+        
+        if (!sync_module_incremental(src, dst, manifest, config.sync_hash, nullptr,
+                                     &ModuleIndex::global().get(mod.id, src))) {
+            LOG_ERROR("Failed to sync module: " + mod.id);
+            failed[i] = 1;
+        }
+    };
+    run_parallel(modules.size(), workers, sync_one);
+    // Only copies can fail, and those only grow when the mirror is an ext4 image
+    retry_after_growing(modules, failed, mirror_root, config.sync_threads, sync_one);
+    
+    if ((bind || erofs) && !partial) {
+        // Detach mounts of modules that are gone or disabled since the last run
+        std::set<std::string> active_ids;
+        for (const auto& mod : modules) active_ids.insert(mod.id);
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(mirror_root, ec)) {
+            if (active_ids.count(entry.path().filename().string()) || !is_mount_point(entry.path())) {
+                continue;
+            }
+            LOG_INFO("Detaching stale mirror mount: " + entry.path().filename().string());
+            umount2(entry.path().c_str(), MNT_DETACH);
+            fs::remove(entry.path(), ec);
+        }
+    }
+    if (erofs && !partial) {
+        prune_erofs_images(modules);
     }
     
-    LOG_INFO("Module sync completed.");
+    size_t mounted_count = std::count(mounted.begin(), mounted.end(), 1);
+    if (bind || erofs) {
+        LOG_INFO(storage_mode + " mirror: " + std::to_string(mounted_count) + " of " + std::to_string(modules.size()) +
+                 " modules mounted");
+    }
+    if (mounted_count < modules.size()) {
+        LOG_INFO("Mirror copy: " + format_copy_stats(get_copy_stats()));
+        LOG_DEBUG("io_uring: " + format_io_ring_stats(get_io_ring_stats()));
+    }
+    
+    if (config.enable_dedup) {
+        std::vector<std::string> ids;
+        for (size_t i = 0; i < modules.size(); ++i) {
+            if (!mounted[i]) ids.push_back(modules[i].id);
+        }
+        dedup_storage(mirror_root, ids, config.sync_threads);
+    }
+    return std::find(failed.begin(), failed.end(), 1) == failed.end();
 }
 
-} // namespace hymo
\ No newline at end of file
+} // namespace hymo
@@ -11,4 +11,16 @@ namespace hymo {
 
 void perform_sync(const std::vector<Module>& modules, const fs::path& storage_root, const Config& config);
 
+// Drop segregated Overlay/Magic sources left in a persistent mirror and
+// invalidate the manifests of the modules they were taken from
+void reset_mirror_staging(const fs::path& mirror_root);
+
+// Copy every module into the HymoFS mirror; returns false if any module failed.
+// For a "bind" or "erofs" storage mode, modules are instead bind mounted read-only
+// from the source or mounted from a per-module EROFS image, falling back to a copy
+// for modules whose labels or rules need one. With partial, modules is a subset of
+// the active modules and mirror entries of the others are left as they are.
+bool sync_modules_to_mirror(const std::vector<Module>& modules, const fs::path& mirror_root, const Config& config,
+                            const std::string& storage_mode = "", bool partial = false);
+
 } // namespace hymo
@@ -14,8 +14,17 @@ constexpr const char* FALLBACK_CONTENT_DIR = "/data/adb/hymo/img_mnt/";
 constexpr const char* BASE_DIR = "/data/adb/hymo/";
 constexpr const char* RUN_DIR = "/data/adb/hymo/run/";
 constexpr const char* STATE_FILE = "/data/adb/hymo/run/daemon_state.json";
+constexpr const char* MODULE_INDEX_FILE = "/data/adb/hymo/run/module_index.bin";
+constexpr const char* PLAN_CACHE_FILE = "/data/adb/hymo/run/plan_cache";
+constexpr const char* APPLIED_RULES_FILE = "/data/adb/hymo/run/applied_rules";
+constexpr const char* HYMOFS_CONFLICTS_FILE = "/data/adb/hymo/run/hymofs_conflicts";
+// Held while reading or changing HymoFS rules, their record or the module index
+constexpr const char* HYMOFS_LOCK_FILE = "/data/adb/hymo/run/hymofs.lock";
+constexpr const char* HOT_UNMOUNTED_DIR = "/data/adb/hymo/run/hot_unmounted/";
 constexpr const char* DAEMON_LOG_FILE = "/data/adb/hymo/daemon.log";
 constexpr const char* SYSTEM_RW_DIR = "/data/adb/hymo/rw";
+constexpr const char* EROFS_IMAGE_DIR = "/data/adb/hymo/erofs/";
+constexpr uint64_t IMAGE_MIN_SIZE_MB = 64;
 constexpr const char* MODULE_PROP_FILE = "/data/adb/modules/hymo/module.prop";
 
 // Marker files
@@ -23,6 +32,9 @@ constexpr const char* DISABLE_FILE_NAME = "disable";
 constexpr const char* REMOVE_FILE_NAME = "remove";
 constexpr const char* SKIP_MOUNT_FILE_NAME = "skip_mount";
 constexpr const char* REPLACE_DIR_FILE_NAME = ".replace";
+constexpr const char* SYNC_MANIFEST_DIR_NAME = ".hymo_manifest";
+constexpr const char* OVERLAY_STAGING_DIR_NAME = ".overlay_staging";
+constexpr const char* DEDUP_STORE_DIR_NAME = ".hymo_store";
 
 // OverlayFS
 constexpr const char* OVERLAY_SOURCE = "KSU";
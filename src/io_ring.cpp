@@ -0,0 +1,409 @@
+// io_ring.cpp - Batched file I/O over io_uring (raw syscalls, no liburing)
+#include "io_ring.hpp"
+#include "defs.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HYMO_HAVE_IO_URING 1
+#endif
+
+namespace hymo {
+
+namespace {
+
+std::atomic<int> g_backend{static_cast<int>(IoBackend::Auto)};
+// Cleared the first time ring setup fails, so other threads don't retry it
+std::atomic<bool> g_ring_usable{true};
+
+std::atomic<uint64_t> g_submits{0};
+std::atomic<uint64_t> g_ops{0};
+std::atomic<uint64_t> g_files{0};
+std::atomic<uint64_t> g_bytes{0};
+
+constexpr unsigned int RING_ENTRIES = 64;
+
+} // namespace
+
+IoBackend parse_io_backend(const std::string& name) {
+    if (name == "sync") return IoBackend::Sync;
+    if (name == "uring" || name == "io_uring") return IoBackend::Uring;
+    return IoBackend::Auto;
+}
+
+const char* io_backend_name(IoBackend backend) {
+    switch (backend) {
+        case IoBackend::Uring: return "uring";
+        case IoBackend::Sync: return "sync";
+        default: return "auto";
+    }
+}
+
+void set_io_backend(IoBackend backend) {
+    g_backend = static_cast<int>(backend);
+}
+
+IoRingStats get_io_ring_stats() {
+    return IoRingStats{g_submits.load(), g_ops.load(), g_files.load(), g_bytes.load()};
+}
+
+void reset_io_ring_stats() {
+    g_submits = 0;
+    g_ops = 0;
+    g_files = 0;
+    g_bytes = 0;
+}
+
+std::string format_io_ring_stats(const IoRingStats& stats) {
+    return std::to_string(stats.ops) + " ops in " + std::to_string(stats.submits) + " submits | " +
+           std::to_string(stats.files) + " small files, " + std::to_string(stats.bytes / 1024) + " KiB";
+}
+
+#ifdef HYMO_HAVE_IO_URING
+
+struct IoRing::Op {
+    uint8_t opcode;
+    int fd;
+    const void* addr;   // path or buffer
+    uint32_t len;       // length, or mode for openat, or statx mask
+    uint64_t off;       // file offset, or statx buffer
+    uint32_t flags;     // open/statx/unlink flags
+    int result = 0;     // filled in by run(): >= 0 or -errno
+    bool done = false;  // completed by the kernel (not failed because the ring broke)
+};
+
+IoRing* IoRing::for_thread() {
+    if (static_cast<IoBackend>(g_backend.load()) == IoBackend::Sync || !g_ring_usable) {
+        return nullptr;
+    }
+
+    thread_local std::unique_ptr<IoRing> ring;
+    thread_local bool tried = false;
+    if (!tried) {
+        tried = true;
+        std::unique_ptr<IoRing> r(new IoRing());
+        if (r->init(RING_ENTRIES)) {
+            ring = std::move(r);
+        } else {
+            g_ring_usable = false;
+        }
+    }
+    return ring.get();
+}
+
+bool IoRing::init(unsigned int entries) {
+    struct io_uring_params p = {};
+    fd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd_ < 0) {
+        // ENOSYS: not built in; EPERM: disabled by sysctl or seccomp
+        auto msg = "io_uring unavailable (" + std::string(strerror(errno)) + "), using synchronous I/O";
+        if (static_cast<IoBackend>(g_backend.load()) == IoBackend::Uring) LOG_WARN(msg);
+        else LOG_DEBUG(msg);
+        return false;
+    }
+    entries_ = p.sq_entries;
+
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+            return false;
+        }
+    }
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        return false;
+    }
+
+    auto* sq = static_cast<char*>(sq_ring_);
+    auto* cq = static_cast<char*>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = cq + p.cq_off.cqes;
+
+    // Everything but unlinkat (5.11) is 5.6; older kernels fail here and stay synchronous
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    std::unique_ptr<char[]> probe_buf(new char[probe_size]());
+    auto* probe = reinterpret_cast<struct io_uring_probe*>(probe_buf.get());
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        LOG_DEBUG("io_uring probe failed, using synchronous I/O");
+        return false;
+    }
+    auto supported = [&](int op) {
+        return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    };
+    for (int op : {IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+        if (!supported(op)) {
+            LOG_DEBUG("io_uring lacks opcode " + std::to_string(op) + ", using synchronous I/O");
+            return false;
+        }
+    }
+    has_unlinkat_ = supported(IORING_OP_UNLINKAT);
+    return true;
+}
+
+IoRing::~IoRing() {
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    if (fd_ >= 0) close(fd_);
+}
+
+// Submit ops in ring-sized chunks and wait for every completion
+void IoRing::run(std::vector<Op>& ops) {
+    auto* sqes = static_cast<struct io_uring_sqe*>(sqes_);
+    auto* cqes = static_cast<struct io_uring_cqe*>(cqes_);
+
+    for (size_t base = 0; base < ops.size(); base += entries_) {
+        unsigned int count = std::min<size_t>(entries_, ops.size() - base);
+
+        unsigned tail = *sq_tail_;
+        unsigned mask = *sq_mask_;
+        for (unsigned int i = 0; i < count; ++i) {
+            const Op& op = ops[base + i];
+            unsigned idx = (tail + i) & mask;
+            struct io_uring_sqe* sqe = &sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = op.opcode;
+            sqe->fd = op.fd;
+            sqe->addr = reinterpret_cast<uint64_t>(op.addr);
+            sqe->len = op.len;
+            sqe->off = op.off;
+            sqe->rw_flags = op.flags; // shares storage with open/statx/unlink flags
+            sqe->user_data = base + i;
+            sq_array_[idx] = idx;
+        }
+        __atomic_store_n(sq_tail_, tail + count, __ATOMIC_RELEASE);
+
+        unsigned int submitted = 0;
+        unsigned int completed = 0;
+        while (completed < count) {
+            unsigned int to_submit = count - submitted;
+            int ret = syscall(__NR_io_uring_enter, fd_, to_submit, count - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+            g_submits++;
+            if (ret < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                // Ring is broken: fail what is left, later chunks included (completions
+                // come in any order); callers fall back per entry
+                int err = errno;
+                for (size_t i = base; i < ops.size(); ++i) {
+                    if (!ops[i].done) ops[i].result = -err;
+                }
+                g_ring_usable = false;
+                return;
+            }
+            submitted += ret;
+
+            unsigned head = __atomic_load_n(cq_head_, __ATOMIC_RELAXED);
+            unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            while (head != cq_tail) {
+                const struct io_uring_cqe* cqe = &cqes[head & *cq_mask_];
+                ops[cqe->user_data].result = cqe->res;
+                ops[cqe->user_data].done = true;
+                head++;
+                completed++;
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+        g_ops += count;
+    }
+}
+
+void IoRing::stat_batch(int dirfd, const std::vector<std::string>& names,
+                        std::vector<struct stat>& out, std::vector<int>& errs) {
+    std::vector<struct statx> stx(names.size());
+    std::vector<Op> ops(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        ops[i] = Op{IORING_OP_STATX, dirfd, names[i].c_str(), STATX_BASIC_STATS,
+                    reinterpret_cast<uint64_t>(&stx[i]), AT_SYMLINK_NOFOLLOW};
+    }
+    run(ops);
+
+    out.assign(names.size(), {});
+    errs.assign(names.size(), 0);
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (ops[i].result < 0) {
+            errs[i] = -ops[i].result;
+            continue;
+        }
+        const struct statx& x = stx[i];
+        struct stat& st = out[i];
+        st.st_dev = makedev(x.stx_dev_major, x.stx_dev_minor);
+        st.st_ino = x.stx_ino;
+        st.st_mode = x.stx_mode;
+        st.st_nlink = x.stx_nlink;
+        st.st_uid = x.stx_uid;
+        st.st_gid = x.stx_gid;
+        st.st_rdev = makedev(x.stx_rdev_major, x.stx_rdev_minor);
+        st.st_size = x.stx_size;
+        st.st_blksize = x.stx_blksize;
+        st.st_blocks = x.stx_blocks;
+        st.st_atim.tv_sec = x.stx_atime.tv_sec;
+        st.st_atim.tv_nsec = x.stx_atime.tv_nsec;
+        st.st_mtim.tv_sec = x.stx_mtime.tv_sec;
+        st.st_mtim.tv_nsec = x.stx_mtime.tv_nsec;
+        st.st_ctim.tv_sec = x.stx_ctime.tv_sec;
+        st.st_ctim.tv_nsec = x.stx_ctime.tv_nsec;
+    }
+}
+
+void IoRing::copy_small_files(const std::vector<SmallCopy>& jobs, std::vector<int>& errs) {
+    const size_t n = jobs.size();
+    errs.assign(n, 0);
+    if (n == 0) return;
+
+    std::vector<std::string> src(n), dst(n);
+    std::vector<std::unique_ptr<char[]>> bufs(n);
+    for (size_t i = 0; i < n; ++i) {
+        src[i] = jobs[i].src.string();
+        dst[i] = jobs[i].dst.string();
+        if (jobs[i].size > SMALL_FILE_MAX) errs[i] = EFBIG;
+    }
+    auto fail = [&](size_t i, int res) {
+        if (errs[i] == 0) errs[i] = res < 0 ? -res : EIO;
+    };
+
+    // 1. dst may be a hardlink into the dedup store: always replace, never write through
+    std::vector<Op> ops;
+    for (size_t i = 0; i < n; ++i) {
+        if (has_unlinkat_) ops.push_back(Op{IORING_OP_UNLINKAT, AT_FDCWD, dst[i].c_str(), 0, 0, 0});
+        else unlink(dst[i].c_str());
+    }
+    run(ops);
+
+    // 2. Open both sides
+    ops.clear();
+    for (size_t i = 0; i < n; ++i) {
+        ops.push_back(Op{IORING_OP_OPENAT, AT_FDCWD, src[i].c_str(), 0, 0, O_RDONLY | O_NOFOLLOW | O_CLOEXEC});
+        ops.push_back(Op{IORING_OP_OPENAT, AT_FDCWD, dst[i].c_str(), 0600, 0,
+                         O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC});
+    }
+    run(ops);
+    std::vector<int> in(n, -1), out(n, -1);
+    for (size_t i = 0; i < n; ++i) {
+        if (ops[2 * i].result >= 0) in[i] = ops[2 * i].result;
+        else fail(i, ops[2 * i].result);
+        if (ops[2 * i + 1].result >= 0) out[i] = ops[2 * i + 1].result;
+        else fail(i, ops[2 * i + 1].result);
+    }
+
+    // 3. Read whole files (one extra byte catches a file that grew since the scan)
+    ops.clear();
+    std::vector<size_t> owner;
+    for (size_t i = 0; i < n; ++i) {
+        if (errs[i] || jobs[i].size == 0) continue;
+        bufs[i].reset(new char[jobs[i].size + 1]);
+        ops.push_back(Op{IORING_OP_READ, in[i], bufs[i].get(), (uint32_t)jobs[i].size + 1, 0, 0});
+        owner.push_back(i);
+    }
+    run(ops);
+    for (size_t k = 0; k < owner.size(); ++k) {
+        if ((uint64_t)ops[k].result != jobs[owner[k]].size) fail(owner[k], ops[k].result);
+    }
+
+    // 4. Write them out
+    ops.clear();
+    owner.clear();
+    for (size_t i = 0; i < n; ++i) {
+        if (errs[i] || jobs[i].size == 0) continue;
+        ops.push_back(Op{IORING_OP_WRITE, out[i], bufs[i].get(), (uint32_t)jobs[i].size, 0, 0});
+        owner.push_back(i);
+    }
+    run(ops);
+    for (size_t k = 0; k < owner.size(); ++k) {
+        if ((uint64_t)ops[k].result != jobs[owner[k]].size) fail(owner[k], ops[k].result);
+    }
+
+    // 5. Metadata has no ring opcode on the kernels we target; it's one call per file
+    for (size_t i = 0; i < n; ++i) {
+        if (errs[i]) continue;
+        if (fchmod(out[i], jobs[i].mode & 07777) != 0) {
+            LOG_WARN("io_ring: fchmod failed for " + dst[i] + ": " + strerror(errno));
+        }
+#ifdef __ANDROID__
+        fsetxattr(out[i], SELINUX_XATTR, DEFAULT_SELINUX_CONTEXT, strlen(DEFAULT_SELINUX_CONTEXT), 0);
+#endif
+    }
+
+    // 6. Close everything that was opened. Closes the ring never ran (it broke
+    // during this or an earlier step) are done here, or the fds would leak.
+    ops.clear();
+    for (size_t i = 0; i < n; ++i) {
+        if (in[i] >= 0) ops.push_back(Op{IORING_OP_CLOSE, in[i], nullptr, 0, 0, 0});
+        if (out[i] >= 0) ops.push_back(Op{IORING_OP_CLOSE, out[i], nullptr, 0, 0, 0});
+    }
+    if (g_ring_usable) run(ops);
+    for (const Op& op : ops) {
+        if (!op.done) close(op.fd);
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (errs[i]) {
+            // Leave nothing half-written behind for the synchronous retry
+            if (out[i] >= 0) unlink(dst[i].c_str());
+            continue;
+        }
+        g_files++;
+        g_bytes += jobs[i].size;
+    }
+}
+
+#else // !HYMO_HAVE_IO_URING
+
+struct IoRing::Op {};
+
+IoRing* IoRing::for_thread() {
+    return nullptr;
+}
+
+bool IoRing::init(unsigned int) {
+    return false;
+}
+
+IoRing::~IoRing() {}
+
+void IoRing::run(std::vector<Op>&) {}
+
+void IoRing::stat_batch(int, const std::vector<std::string>& names, std::vector<struct stat>& out, std::vector<int>& errs) {
+    out.assign(names.size(), {});
+    errs.assign(names.size(), ENOSYS);
+}
+
+void IoRing::copy_small_files(const std::vector<SmallCopy>& jobs, std::vector<int>& errs) {
+    errs.assign(jobs.size(), ENOSYS);
+}
+
+#endif
+
+} // namespace hymo
@@ -0,0 +1,94 @@
+// io_ring.hpp - Batched file I/O over io_uring
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+enum class IoBackend {
+    Auto,   // io_uring when the kernel allows it, synchronous syscalls otherwise
+    Uring,  // same as Auto, but log why io_uring could not be used
+    Sync
+};
+
+IoBackend parse_io_backend(const std::string& name);
+const char* io_backend_name(IoBackend backend);
+void set_io_backend(IoBackend backend);
+
+struct SmallCopy {
+    fs::path src;
+    fs::path dst;
+    mode_t mode;
+    uint64_t size;
+};
+
+// One io_uring instance per thread. Every call submits a whole batch of
+// operations and waits for all of them, so a directory costs a handful of
+// syscalls instead of one or more per entry.
+class IoRing {
+public:
+    // Largest file copy_small_files takes; bigger files go through the copy engine
+    static constexpr uint64_t SMALL_FILE_MAX = 64 * 1024;
+
+    // The calling thread's ring, or nullptr if the backend is Sync or io_uring
+    // (or one of the required opcodes) is unavailable
+    static IoRing* for_thread();
+
+    ~IoRing();
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // lstat() of every name relative to dirfd; errs[i] is 0 or an errno
+    void stat_batch(int dirfd, const std::vector<std::string>& names,
+                    std::vector<struct stat>& out, std::vector<int>& errs);
+
+    // Replace each dst with a copy of src (mode set, default SELinux context);
+    // errs[i] is 0 or an errno, failed entries can be retried synchronously
+    void copy_small_files(const std::vector<SmallCopy>& jobs, std::vector<int>& errs);
+
+private:
+    IoRing() = default;
+    bool init(unsigned int entries);
+
+    struct Op;
+    void run(std::vector<Op>& ops);
+
+    int fd_ = -1;
+    unsigned int entries_ = 0;
+    bool has_unlinkat_ = false;
+
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    void* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    void* cqes_ = nullptr;
+};
+
+struct IoRingStats {
+    uint64_t submits = 0; // io_uring_enter calls
+    uint64_t ops = 0;     // operations completed through rings
+    uint64_t files = 0;   // small files copied
+    uint64_t bytes = 0;
+};
+
+IoRingStats get_io_ring_stats();
+void reset_io_ring_stats();
+std::string format_io_ring_stats(const IoRingStats& stats);
+
+} // namespace hymo
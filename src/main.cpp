@@ -1,11 +1,21 @@
 // main.cpp - Main entry point
 #include "defs.hpp"
 #include "utils.hpp"
+#include "io_ring.hpp"
+#include "walker.hpp"
 #include "conf/config.hpp"
 #include "core/inventory.hpp"
 #include "core/storage.hpp"
 #include "core/sync.hpp"
+#include "core/erofs.hpp"
+#include "core/manifest.hpp"
+#include "core/module_tree.hpp"
 #include "core/planner.hpp"
+#include "core/plan_cache.hpp"
+#include "core/conflict_report.hpp"
+#include "core/rule_trie.hpp"
+#include "core/applied_rules.hpp"
+#include "core/module_watch.hpp"
 #include "core/executor.hpp"
 #include "core/modules.hpp"
 #include "core/state.hpp"
@@ -14,7 +24,10 @@
 #include <fstream>
 #include <cstdlib>
 #include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <getopt.h>
+#include <dirent.h>
 #include <sys/mount.h>
 
 namespace fs = std::filesystem;
@@ -29,6 +42,9 @@ struct CliOptions {
     bool verbose = false;
     std::vector<std::string> partitions;
     std::string output;
+    bool json = false;
+    std::string prefix;
+    std::string module;
     std::vector<std::string> args;
 };
 
@@ -40,10 +56,12 @@ static void print_help() {
     std::cout << "  show-config     Show current configuration\n";
     std::cout << "  storage         Show storage status\n";
     std::cout << "  modules         List active modules\n";
-    std::cout << "  reload          Reload HymoFS mappings\n";
+    std::cout << "  reload          Reload HymoFS mappings (--module ID: sync only that module)\n";
+    std::cout << "  watch           Keep running and reload modules as they change\n";
     std::cout << "  clear           Clear all HymoFS mappings\n";
     std::cout << "  version         Show HymoFS protocol and config version\n";
     std::cout << "  list            List all active HymoFS rules\n";
+    std::cout << "  conflicts       Show paths several HymoFS modules provide and which one wins\n";
     std::cout << "  debug <on|off>  Enable/Disable kernel debug logging\n";
     std::cout << "  raw <cmd> ...   Execute raw HymoFS command (add/hide/delete)\n";
     std::cout << "  add <mod_id>    Add module rules to HymoFS\n";
@@ -51,7 +69,10 @@ static void print_help() {
     std::cout << "  set-mode <mod_id> <mode>  Set mount mode for a module (auto, hymofs, overlay, magic, none)\n";
     std::cout << "  add-rule <mod_id> <path> <mode> Add a custom mount rule for a module\n";
     std::cout << "  remove-rule <mod_id> <path> Remove a custom mount rule for a module\n";
-    std::cout << "  sync-partitions Scan modules and auto-add new partitions to config\n\n";
+    std::cout << "  sync-partitions Scan modules and auto-add new partitions to config\n";
+    std::cout << "  mkerofs <dir> <img> Build an EROFS image of a directory (as used by the erofs mirror)\n";
+    std::cout << "  bench-io <dir> [scratch] Time module sync of a directory with io_uring vs synchronous I/O\n";
+    std::cout << "  bench-rules <dir> [scratch] Time HymoFS rule submission for a directory (simulated device)\n\n";
     std::cout << "Options:\n";
     std::cout << "  -c, --config FILE       Config file path\n";
     std::cout << "  -m, --moduledir DIR     Module directory\n";
@@ -60,12 +81,15 @@ static void print_help() {
     std::cout << "  -v, --verbose           Verbose logging\n";
     std::cout << "  -p, --partition NAME    Add partition (can be used multiple times)\n";
     std::cout << "  -o, --output FILE       Output file (for gen-config)\n";
+    std::cout << "      --json              JSON output (for list, conflicts)\n";
+    std::cout << "      --prefix PATH       Only rules whose path starts with PATH (for list, conflicts)\n";
+    std::cout << "      --module ID         Only rules of module ID (for list, conflicts), or the module to reload\n";
     std::cout << "  -h, --help              Show this help\n";
 }
 
 // Helper to segregate custom rules (Overlay/Magic) from HymoFS source tree
 static void segregate_custom_rules(MountPlan& plan, const fs::path& mirror_dir) {
-    fs::path staging_dir = mirror_dir / ".overlay_staging";
+    fs::path staging_dir = mirror_dir / OVERLAY_STAGING_DIR_NAME;
     
     // Process Overlay Ops
     for (auto& op : plan.overlay_ops) {
@@ -85,13 +109,14 @@ static void segregate_custom_rules(MountPlan& plan, const fs::path& mirror_dir)
             if (layer_str.find(mirror_str) == 0) {
                 // It is inside mirror. Move it to staging.
                 // Construct relative path from mirror root
-                fs::path rel = fs::relative(layer, mirror_dir);
+                fs::path rel = layer.lexically_relative(mirror_dir);
                 fs::path target = staging_dir / rel;
                 
                 try {
                     if (fs::exists(layer)) {
                         fs::create_directories(target.parent_path());
                         fs::rename(layer, target);
+                        ModuleIndex::global().alias(target, layer);
                         // Update the layer path in the plan
                         layer = target;
                         LOG_DEBUG("Segregated custom rule source: " + layer_str + " -> " + target.string());
@@ -110,13 +135,14 @@ static void segregate_custom_rules(MountPlan& plan, const fs::path& mirror_dir)
         std::string mirror_str = mirror_dir.string();
         
         if (path_str.find(mirror_str) == 0) {
-            fs::path rel = fs::relative(path, mirror_dir);
+            fs::path rel = path.lexically_relative(mirror_dir);
             fs::path target = staging_dir / rel;
             
             try {
                 if (fs::exists(path)) {
                     fs::create_directories(target.parent_path());
                     fs::rename(path, target);
+                    ModuleIndex::global().alias(target, path);
                     path = target;
                     LOG_DEBUG("Segregated magic rule source: " + path_str + " -> " + target.string());
                 }
@@ -127,6 +153,396 @@ static void segregate_custom_rules(MountPlan& plan, const fs::path& mirror_dir)
     }
 }
 
+// Fresh directory inside parent for a benchmark to fill and then remove. Never parent
+// itself: it may be a directory the user cares about. Empty on failure.
+static fs::path make_scratch_dir(const fs::path& parent) {
+    if (!ensure_dir_exists(parent)) return {};
+    std::string dir = (parent / "hymo_bench.XXXXXX").string();
+    if (!mkdtemp(dir.data())) return {};
+    return dir;
+}
+
+// Full copy and unchanged rescan of src per backend, best of two runs each
+static int run_io_bench(const fs::path& src, const fs::path& scratch_parent) {
+    fs::path scratch = make_scratch_dir(scratch_parent);
+    if (scratch.empty()) {
+        std::cerr << "Cannot create a scratch directory in " << scratch_parent << "\n";
+        return 1;
+    }
+    auto now = [] { return std::chrono::steady_clock::now(); };
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+    std::cout << "backend  full copy    rescan\n";
+    for (IoBackend backend : {IoBackend::Sync, IoBackend::Uring}) {
+        set_io_backend(backend);
+        if (backend == IoBackend::Uring && !IoRing::for_thread()) {
+            std::cout << "uring    unavailable\n";
+            continue;
+        }
+
+        double best_copy = 0, best_scan = 0;
+        for (int round = 0; round < 2; ++round) {
+            std::error_code ec;
+            fs::path dst = scratch / "tree";
+            fs::path manifest = scratch / "manifest.list";
+            fs::remove_all(dst, ec);
+            fs::remove(manifest, ec);
+
+            auto t0 = now();
+            if (!sync_module_incremental(src, dst, manifest, false)) {
+                std::cerr << "Sync failed with " << io_backend_name(backend) << " backend.\n";
+                fs::remove_all(scratch, ec);
+                return 1;
+            }
+            auto t1 = now();
+            sync_module_incremental(src, dst, manifest, false);
+            auto t2 = now();
+
+            if (round == 0 || ms(t1 - t0) < best_copy) best_copy = ms(t1 - t0);
+            if (round == 0 || ms(t2 - t1) < best_scan) best_scan = ms(t2 - t1);
+        }
+        std::cout << std::left << std::setw(8) << io_backend_name(backend) << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(9) << best_copy << " ms" << std::setw(9) << best_scan << " ms\n";
+    }
+
+    std::error_code ec;
+    fs::remove_all(scratch, ec);
+    return 0;
+}
+
+// Rules for every file below dir, submitted to a simulated control device: open and
+// ioctl per rule (the standalone calls), one fd with single ioctls, and batches
+static int run_rule_bench(const fs::path& dir, const fs::path& scratch_parent) {
+    auto now = [] { return std::chrono::steady_clock::now(); };
+    auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+    std::vector<std::pair<std::string, std::string>> rules;
+    std::error_code ec = walk_tree(dir, [&](const WalkEntry& entry) {
+        if (S_ISREG(entry.st.st_mode) || S_ISLNK(entry.st.st_mode)) {
+            rules.emplace_back("/system/" + entry.rel, entry.path().string());
+        }
+        return WalkAction::Continue;
+    });
+    if (ec || rules.empty()) {
+        std::cerr << "No files to generate rules from in " << dir << "\n";
+        return 1;
+    }
+    fs::path scratch = make_scratch_dir(scratch_parent);
+    if (scratch.empty()) {
+        std::cerr << "Cannot create a scratch directory in " << scratch_parent << "\n";
+        return 1;
+    }
+    fs::path dev = scratch / "hymo_ctl";
+    auto finish = [&](int status) {
+        HymoFS::simulate_device({}, 0);
+        std::error_code remove_ec;
+        fs::remove_all(scratch, remove_ec);
+        return status;
+    };
+
+    std::cout << rules.size() << " rules\n";
+    std::cout << "method        time    ioctls\n";
+    for (std::string method : {"oneshot", "single", "batched"}) {
+        bool batched = method == "batched";
+        HymoFS::simulate_device(dev, batched ? HYMO_PROTOCOL_VERSION + 1 : HYMO_PROTOCOL_VERSION);
+
+        double best = 0;
+        size_t ioctls = rules.size();
+        for (int round = 0; round < 2; ++round) {
+            HymoFS::clear_rules();
+            auto t0 = now();
+            if (method == "oneshot") {
+                for (const auto& [src, target] : rules) HymoFS::add_rule(src, target, DT_REG);
+            } else {
+                HymoFSSession session;
+                for (const auto& [src, target] : rules) session.add_rule(src, target, DT_REG);
+                session.flush();
+                ioctls = session.ioctls();
+            }
+            auto t1 = now();
+            if (round == 0 || ms(t1 - t0) < best) best = ms(t1 - t0);
+        }
+
+        // The stand-in logs one line per applied rule
+        std::ifstream log(dev);
+        size_t lines = std::count(std::istreambuf_iterator<char>(log), std::istreambuf_iterator<char>(), '\n');
+        if (lines != rules.size()) {
+            std::cerr << method << ": device holds " << lines << " rules, expected " << rules.size() << "\n";
+            return finish(1);
+        }
+        std::cout << std::left << std::setw(8) << method << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(9) << best << " ms" << std::setw(10) << ioctls << "\n";
+    }
+
+    return finish(0);
+}
+
+// Module a rule belongs to, from where its target lives (mirror, module dir or
+// storage). Hide rules have no target; only the applied rule record knows theirs.
+static std::string rule_module(const std::string& target, const std::vector<std::string>& roots) {
+    for (const auto& root : roots) {
+        if (target.size() > root.size() && target.compare(0, root.size(), root) == 0) {
+            size_t end = target.find('/', root.size());
+            std::string id = target.substr(root.size(), end == std::string::npos ? std::string::npos : end - root.size());
+            return id == OVERLAY_STAGING_DIR_NAME ? "" : id;
+        }
+    }
+    return "";
+}
+
+// Kernel rules as they are read, filtered by path prefix and module
+static int list_hymofs_rules(const Config& config, const CliOptions& cli) {
+    std::vector<std::string> roots;
+    for (const fs::path& root : {fs::path(HYMO_MIRROR_DEV), config.moduledir, fs::path(FALLBACK_CONTENT_DIR)}) {
+        std::string r = root.lexically_normal().string();
+        if (r.empty() || r.back() != '/') r += '/';
+        roots.push_back(r);
+    }
+
+    HymoRules applied;
+    load_applied_rules(applied);
+
+    size_t count = 0;
+    if (cli.json) std::cout << "{\n  \"rules\": [";
+    bool ok = HymoFS::list_rules([&](const HymoRuleEntry& rule) {
+        if (!cli.prefix.empty() && rule.src.compare(0, cli.prefix.size(), cli.prefix) != 0) return true;
+        std::string module = rule.target.empty() ? "" : rule_module(rule.target, roots);
+        if (module.empty()) {
+            auto it = applied.owners.find(rule.src);
+            if (it != applied.owners.end()) module = it->second;
+        }
+        if (!cli.module.empty() && module != cli.module) return true;
+
+        if (cli.json) {
+            std::cout << (count ? ",\n" : "\n") << "    {\"kind\": \"" << json_escape(rule.kind) << "\", \"path\": \""
+                      << json_escape(rule.src) << "\"";
+            if (!rule.target.empty()) {
+                std::cout << ", \"target\": \"" << json_escape(rule.target) << "\", \"type\": " << rule.type;
+            }
+            if (!module.empty()) {
+                std::cout << ", \"module\": \"" << json_escape(module) << "\"";
+            }
+            std::cout << "}";
+        } else {
+            std::cout << rule.kind << " " << rule.src;
+            if (!rule.target.empty()) std::cout << " " << rule.target << " " << rule.type;
+            std::cout << "\n";
+        }
+        count++;
+        return true;
+    });
+    if (cli.json) {
+        std::cout << (count ? "\n  " : "") << "],\n  \"count\": " << count << "\n}\n";
+    }
+    if (!ok) {
+        std::cerr << "Failed to read rules from " << HYMO_CTL_DEV << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Which module shadows which, from the report saved when rules were last built
+static int print_conflict_report(const CliOptions& cli) {
+    HymoConflictReport report;
+    if (!load_conflict_report(report)) {
+        std::cerr << "No HymoFS conflict report (written when HymoFS rules are built).\n";
+        return 1;
+    }
+
+    // Per shadowed module: paths lost, and to whom
+    std::map<std::string, std::map<std::string, size_t>> lost;
+    std::vector<const HymoConflict*> shown;
+    for (const auto& conflict : report.conflicts) {
+        if (!cli.prefix.empty() && conflict.path.compare(0, cli.prefix.size(), cli.prefix) != 0) continue;
+        bool involved = cli.module.empty() || conflict.winner == cli.module;
+        for (const auto& id : conflict.shadowed) {
+            lost[id][conflict.winner]++;
+            involved = involved || id == cli.module;
+        }
+        if (involved) shown.push_back(&conflict);
+    }
+    auto total_lost = [&](const std::map<std::string, size_t>& by) {
+        size_t n = 0;
+        for (const auto& [winner, count] : by) n += count;
+        return n;
+    };
+
+    if (cli.json) {
+        std::cout << "{\n  \"modules\": [";
+        bool first = true;
+        for (const auto& [id, by] : lost) {
+            if (!cli.module.empty() && id != cli.module) continue;
+            std::cout << (first ? "\n" : ",\n") << "    {\"id\": \"" << json_escape(id) << "\", \"paths\": "
+                      << report.provided[id] << ", \"shadowed\": " << total_lost(by) << ", \"by\": {";
+            bool first_by = true;
+            for (const auto& [winner, count] : by) {
+                std::cout << (first_by ? "" : ", ") << "\"" << json_escape(winner) << "\": " << count;
+                first_by = false;
+            }
+            std::cout << "}}";
+            first = false;
+        }
+        std::cout << (first ? "" : "\n  ") << "],\n  \"conflicts\": [";
+        for (size_t i = 0; i < shown.size(); i++) {
+            std::cout << (i ? ",\n" : "\n") << "    {\"path\": \"" << json_escape(shown[i]->path) << "\", \"winner\": \""
+                      << json_escape(shown[i]->winner) << "\", \"shadowed\": [";
+            for (size_t j = 0; j < shown[i]->shadowed.size(); j++) {
+                std::cout << (j ? ", " : "") << "\"" << json_escape(shown[i]->shadowed[j]) << "\"";
+            }
+            std::cout << "]}";
+        }
+        std::cout << (shown.empty() ? "" : "\n  ") << "],\n  \"count\": " << shown.size() << "\n}\n";
+        return 0;
+    }
+
+    for (const auto& [id, by] : lost) {
+        if (!cli.module.empty() && id != cli.module) continue;
+        size_t n = total_lost(by);
+        std::cout << id << ": " << n << " of " << report.provided[id] << " paths shadowed by";
+        for (const auto& [winner, count] : by) {
+            std::cout << " " << winner << " (" << count << ")";
+        }
+        if (n == report.provided[id]) std::cout << " - fully shadowed, has no effect";
+        std::cout << "\n";
+    }
+    for (const auto* conflict : shown) {
+        std::cout << conflict->path << " " << conflict->winner << " >";
+        for (const auto& id : conflict->shadowed) {
+            std::cout << " " << id;
+        }
+        std::cout << "\n";
+    }
+    if (shown.empty()) std::cout << "No conflicts.\n";
+    return 0;
+}
+
+// Sync modules into the mirror again and bring the HymoFS mappings up to date. With
+// only_modules, those modules and any whose layout changed since the index was saved
+// are synced; the rest of the mirror is used as it is. Only the rule delta is sent.
+static void reload_hymofs(const Config& config, const std::set<std::string>& only_modules) {
+    // hot_mount.sh, hot_unmount.sh and hymod watch may reload at the same time
+    FileLock lock(HYMOFS_LOCK_FILE);
+    auto started = std::chrono::steady_clock::now();
+    bool targeted = !only_modules.empty();
+    std::string targets;
+    for (const auto& id : only_modules) targets += (targets.empty() ? "" : ", ") + id;
+    LOG_INFO(targeted ? "Reloading HymoFS mappings for " + targets + "..." : "Reloading HymoFS mappings...");
+    const fs::path MIRROR_DIR = hymo::HYMO_MIRROR_DEV;
+    std::string storage_mode = load_runtime_state().storage_mode;
+
+    if (targeted) {
+        // Unchanged modules come back from the saved index without a walk
+        ModuleIndex::global().load(MODULE_INDEX_FILE);
+        for (const auto& id : only_modules) ModuleIndex::global().forget(id);
+    }
+    
+    // 1. Scan modules
+    auto module_list = scan_modules(config.moduledir, config);
+    
+    // 2. Filter active
+    std::vector<Module> active_modules;
+    std::vector<std::string> all_partitions = BUILTIN_PARTITIONS;
+    for (const auto& part : config.partitions) all_partitions.push_back(part);
+
+    for (const auto& mod : module_list) {
+        // Check for hot unmount marker
+        if (fs::exists(fs::path(HOT_UNMOUNTED_DIR) / mod.id)) {
+            LOG_INFO("Skipping hot-unmounted module: " + mod.id);
+            continue;
+        }
+
+        bool has_content = false;
+        for (const auto& part : all_partitions) {
+            if (ModuleIndex::global().get(mod.id, mod.source_path).has_files(part)) {
+                has_content = true;
+                break;
+            }
+        }
+        if (has_content) active_modules.push_back(mod);
+    }
+    module_list = active_modules;
+
+    // 3. Sync to mirror (bind/erofs mirrors only attach, refresh or detach modules)
+    if (targeted) {
+        std::vector<Module> changed;
+        std::set<std::string> still_active;
+        for (const auto& mod : module_list) {
+            std::error_code ec;
+            if (only_modules.count(mod.id)) still_active.insert(mod.id);
+            if (only_modules.count(mod.id) || ModuleIndex::global().get(mod.id, mod.source_path).dirs_read() > 0 ||
+                !fs::exists(MIRROR_DIR / mod.id, ec)) {
+                changed.push_back(mod);
+            }
+        }
+        LOG_INFO("Syncing " + std::to_string(changed.size()) + " of " + std::to_string(module_list.size()) +
+                 " modules to mirror...");
+        sync_modules_to_mirror(changed, MIRROR_DIR, config, storage_mode, true);
+
+        // Disabled or hot-unmounted: its rules go away below, a mirror mount goes now
+        for (const auto& id : only_modules) {
+            fs::path dst = MIRROR_DIR / id;
+            if (!still_active.count(id) && is_mount_point(dst)) {
+                umount2(dst.c_str(), MNT_DETACH);
+                std::error_code ec;
+                fs::remove(dst, ec);
+            }
+        }
+    } else {
+        LOG_INFO("Syncing modules to mirror...");
+        sync_modules_to_mirror(module_list, MIRROR_DIR, config, storage_mode);
+    }
+    
+    // 4. Update mappings
+    MountPlan plan = generate_plan(config, module_list, MIRROR_DIR);
+    update_hymofs_mappings(config, module_list, MIRROR_DIR, plan);
+    
+    // Apply Stealth Mode
+    if (HymoFS::set_stealth(config.enable_stealth)) {
+        LOG_INFO("Stealth mode set to: " + std::string(config.enable_stealth ? "true" : "false"));
+    } else {
+        LOG_WARN("Failed to set stealth mode.");
+    }
+
+    // 5. Update Runtime State (daemon_state.json)
+    RuntimeState state = load_runtime_state();
+    
+    if (state.storage_mode.empty()) {
+        state.storage_mode = "hymofs";
+    }
+    state.mount_point = MIRROR_DIR.string();
+    state.hymofs_module_ids = plan.hymofs_module_ids;
+    
+    // Recalculate active mounts for HymoFS
+    state.active_mounts.clear();
+    std::vector<std::string> all_parts = BUILTIN_PARTITIONS;
+    for(const auto& p : config.partitions) all_parts.push_back(p);
+    
+    for (const auto& part : all_parts) {
+        bool active = false;
+        for (const auto& mod_id : plan.hymofs_module_ids) {
+            for (const auto& m : module_list) {
+                if (m.id == mod_id) {
+                    if (fs::exists(m.source_path / part)) {
+                        active = true;
+                        break;
+                    }
+                }
+            }
+            if (active) break;
+        }
+        if (active) state.active_mounts.push_back(part);
+    }
+    
+    state.save();
+    // A full reload walks every module (edits in place don't touch directory times),
+    // so it leaves a fully fresh index for the next boot. A targeted one keeps the
+    // loaded records of the other modules, refreshed only where their layout changed.
+    ModuleIndex::global().save(MODULE_INDEX_FILE);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    LOG_INFO("Reload complete in " + std::to_string(elapsed.count()) + " ms.");
+}
+
 static CliOptions parse_args(int argc, char* argv[]) {
     CliOptions opts;
     
@@ -138,6 +554,9 @@ static CliOptions parse_args(int argc, char* argv[]) {
         {"verbose", no_argument, 0, 'v'},
         {"partition", required_argument, 0, 'p'},
         {"output", required_argument, 0, 'o'},
+        {"json", no_argument, 0, 'J'},
+        {"prefix", required_argument, 0, 'P'},
+        {"module", required_argument, 0, 'M'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -168,6 +587,15 @@ static CliOptions parse_args(int argc, char* argv[]) {
             case 'o':
                 opts.output = optarg;
                 break;
+            case 'J':
+                opts.json = true;
+                break;
+            case 'P':
+                opts.prefix = optarg;
+                break;
+            case 'M':
+                opts.module = optarg;
+                break;
             case 'h':
                 print_help();
                 exit(0);
@@ -237,6 +665,16 @@ int main(int argc, char* argv[]) {
                 std::cout << "  \"ignore_protocol_mismatch\": " << (config.ignore_protocol_mismatch ? "true" : "false") << ",\n";
                 std::cout << "  \"enable_kernel_debug\": " << (config.enable_kernel_debug ? "true" : "false") << ",\n";
                 std::cout << "  \"enable_stealth\": " << (config.enable_stealth ? "true" : "false") << ",\n";
+                std::cout << "  \"sync_threads\": " << config.sync_threads << ",\n";
+                std::cout << "  \"sync_hash\": " << (config.sync_hash ? "true" : "false") << ",\n";
+                std::cout << "  \"copy_strategy\": \"" << config.copy_strategy << "\",\n";
+                std::cout << "  \"io_backend\": \"" << config.io_backend << "\",\n";
+                std::cout << "  \"enable_dedup\": " << (config.enable_dedup ? "true" : "false") << ",\n";
+                std::cout << "  \"mirror_backend\": \"" << config.mirror_backend << "\",\n";
+                std::cout << "  \"image_journal\": " << (config.image_journal ? "true" : "false") << ",\n";
+                std::cout << "  \"trim_image\": " << (config.trim_image ? "true" : "false") << ",\n";
+                std::cout << "  \"plan_cache\": " << (config.plan_cache ? "true" : "false") << ",\n";
+                std::cout << "  \"compact_rules\": " << (config.compact_rules ? "true" : "false") << ",\n";
                 std::cout << "  \"hymofs_available\": " << (HymoFS::is_available() ? "true" : "false") << ",\n";
                 std::cout << "  \"hymofs_status\": " << (int)HymoFS::check_status() << ",\n";
                 std::cout << "  \"partitions\": [";
@@ -309,17 +747,46 @@ int main(int argc, char* argv[]) {
                 std::sort(all_partitions.begin(), all_partitions.end());
                 all_partitions.erase(std::unique(all_partitions.begin(), all_partitions.end()), all_partitions.end());
 
+                // Per-path modes the module was given, as mount would apply them
+                RuleTrie rules;
+                for (const auto& mod : scan_modules(config.moduledir, config)) {
+                    if (mod.id == module_id) {
+                        rules = RuleTrie(mod.rules);
+                        break;
+                    }
+                }
+
+                // The added rules go on record under the module, replacing what was on
+                // their paths. Without a record the next reload starts over anyway.
+                FileLock lock(HYMOFS_LOCK_FILE);
+                HymoRules applied;
+                bool recorded = load_applied_rules(applied);
+                forget_applied_rules();
+                HymoRules added;
                 int success_count = 0;
                 for (const auto& part : all_partitions) {
                     fs::path src_dir = module_path / part;
                     if (fs::exists(src_dir) && fs::is_directory(src_dir)) {
                         fs::path target_base = fs::path("/") / part;
-                        if (HymoFS::add_rules_from_directory(target_base, src_dir)) {
+                        if (HymoFS::add_rules_from_directory(target_base, src_dir, config.compact_rules, &rules,
+                                                             recorded ? &added : nullptr)) {
                              if (config.verbose) std::cout << "Added rules for " << src_dir << " to " << target_base << "\n";
                              success_count++;
+                        } else {
+                            recorded = false;
                         }
                     }
                 }
+                if (recorded) {
+                    std::set<std::string> paths;
+                    for (const auto& rule : added.add_rules) paths.insert(rule.src);
+                    paths.insert(added.hide_rules.begin(), added.hide_rules.end());
+                    applied.erase(paths);
+                    applied.add_rules.insert(applied.add_rules.end(), added.add_rules.begin(), added.add_rules.end());
+                    applied.hide_rules.insert(applied.hide_rules.end(), added.hide_rules.begin(), added.hide_rules.end());
+                    for (const auto& path : paths) applied.owners[path] = module_id;
+                    save_applied_rules(applied);
+                }
                 
                 if (success_count > 0) {
                     std::cout << "Successfully added module " << module_id << "\n";
@@ -358,20 +825,44 @@ int main(int argc, char* argv[]) {
                 std::sort(all_partitions.begin(), all_partitions.end());
                 all_partitions.erase(std::unique(all_partitions.begin(), all_partitions.end()), all_partitions.end());
 
+                // The record says exactly which rules the module has; only without one
+                // are they rediscovered from its current files
+                FileLock lock(HYMOFS_LOCK_FILE);
+                HymoRules applied;
+                bool recorded = load_applied_rules(applied);
+                forget_applied_rules();
                 int success_count = 0;
-                for (const auto& part : all_partitions) {
-                    fs::path src_dir = module_path / part;
-                    if (fs::exists(src_dir) && fs::is_directory(src_dir)) {
-                        fs::path target_base = fs::path("/") / part;
-                        if (HymoFS::remove_rules_from_directory(target_base, src_dir)) {
-                             if (config.verbose) std::cout << "Deleted rules for " << src_dir << "\n";
-                             success_count++;
+                if (recorded) {
+                    HymoRules owned = applied.of_module(module_id);
+                    std::set<std::string> paths;
+                    HymoFSSession session;
+                    for (const auto& rule : owned.add_rules) paths.insert(rule.src);
+                    paths.insert(owned.hide_rules.begin(), owned.hide_rules.end());
+                    for (const auto& path : paths) {
+                        session.delete_rule(path);
+                        if (config.verbose) std::cout << "Deleted rule for " << path << "\n";
+                    }
+                    if (session.flush() && session.failures() == 0) {
+                        applied.erase(paths);
+                        save_applied_rules(applied);
+                    }
+                    success_count = paths.size();
+                } else {
+                    for (const auto& part : all_partitions) {
+                        fs::path src_dir = module_path / part;
+                        if (fs::exists(src_dir) && fs::is_directory(src_dir)) {
+                            fs::path target_base = fs::path("/") / part;
+                            if (HymoFS::remove_rules_from_directory(target_base, src_dir)) {
+                                 if (config.verbose) std::cout << "Deleted rules for " << src_dir << "\n";
+                                 success_count++;
+                            }
                         }
                     }
                 }
                 
                 if (success_count > 0) {
-                    std::cout << "Successfully removed " << success_count << " rules for module " << module_id << "\n";
+                    std::cout << "Successfully removed " << success_count << (recorded ? " rules" : " rule sets")
+                              << " for module " << module_id << "\n";
                     LOG_INFO("CLI: Removed rules for module " + module_id);
                     
                     // Update runtime state
@@ -385,6 +876,34 @@ int main(int argc, char* argv[]) {
                     std::cout << "No active rules found or removed for module " << module_id << "\n";
                 }
                 return 0;
+            } else if (cli.command == "mkerofs") {
+                if (cli.args.size() < 2) {
+                    std::cerr << "Usage: hymod mkerofs <source_dir> <image>\n";
+                    return 1;
+                }
+                ErofsImageInfo info;
+                auto label = [](const fs::path&, mode_t) { return std::string(DEFAULT_SELINUX_CONTEXT); };
+                if (!build_erofs_image(cli.args[0], cli.args[1], label, &info)) {
+                    std::cerr << "Failed to build EROFS image.\n";
+                    return 1;
+                }
+                std::cout << "Built " << cli.args[1] << ": " << info.inodes << " inodes, "
+                          << info.blocks << " blocks, " << info.data_bytes << " data bytes\n";
+                return 0;
+            } else if (cli.command == "bench-io") {
+                if (cli.args.empty()) {
+                    std::cerr << "Usage: hymod bench-io <source_dir> [scratch_dir]\n";
+                    return 1;
+                }
+                fs::path scratch = cli.args.size() > 1 ? fs::path(cli.args[1]) : fs::path(RUN_DIR) / "io_bench";
+                return run_io_bench(cli.args[0], scratch);
+            } else if (cli.command == "bench-rules") {
+                if (cli.args.empty()) {
+                    std::cerr << "Usage: hymod bench-rules <source_dir> [scratch_dir]\n";
+                    return 1;
+                }
+                fs::path scratch = cli.args.size() > 1 ? fs::path(cli.args[1]) : fs::path(RUN_DIR) / "rule_bench";
+                return run_rule_bench(cli.args[0], scratch);
             } else if (cli.command == "storage") {
                 print_storage_status();
                 return 0;
@@ -394,6 +913,8 @@ int main(int argc, char* argv[]) {
                 return 0;
             } else if (cli.command == "clear") {
                 if (HymoFS::is_available()) {
+                    FileLock lock(HYMOFS_LOCK_FILE);
+                    forget_applied_rules();
                     if (HymoFS::clear_rules()) {
                         std::cout << "Successfully cleared all HymoFS rules.\n";
                         LOG_INFO("User manually cleared all HymoFS rules via CLI");
@@ -422,13 +943,17 @@ int main(int argc, char* argv[]) {
                 }
                 return 0;
             } else if (cli.command == "list") {
-                if (HymoFS::is_available()) {
-                    std::string rules = HymoFS::get_active_rules();
-                    std::cout << rules;
-                } else {
+                if (!HymoFS::is_available()) {
                     std::cout << "HymoFS not available.\n";
+                    return 0;
                 }
-                return 0;
+                if (!cli.json && cli.prefix.empty() && cli.module.empty()) {
+                    std::cout << HymoFS::get_active_rules();
+                    return 0;
+                }
+                return list_hymofs_rules(load_config(cli), cli);
+            } else if (cli.command == "conflicts") {
+                return print_conflict_report(cli);
             } else if (cli.command == "debug") {
                 if (cli.args.empty()) {
                     std::cerr << "Usage: hymod debug <on|off>\n";
@@ -457,6 +982,8 @@ int main(int argc, char* argv[]) {
                 }
                 std::string cmd = cli.args[0];
                 bool success = false;
+                FileLock lock(HYMOFS_LOCK_FILE);
+                forget_applied_rules();
                 
                 if (cmd == "add") {
                     if (cli.args.size() < 3) {
@@ -576,91 +1103,37 @@ int main(int argc, char* argv[]) {
                 Logger::getInstance().init(config.verbose, DAEMON_LOG_FILE);
                 
                 if (HymoFS::is_available()) {
-                    LOG_INFO("Reloading HymoFS mappings...");
-                    const fs::path MIRROR_DIR = hymo::HYMO_MIRROR_DEV;
-                    
-                    // 1. Scan modules
-                    auto module_list = scan_modules(config.moduledir, config);
-                    
-                    // 2. Filter active
-                    std::vector<Module> active_modules;
-                    std::vector<std::string> all_partitions = BUILTIN_PARTITIONS;
-                    for (const auto& part : config.partitions) all_partitions.push_back(part);
-
-                    for (const auto& mod : module_list) {
-                        // Check for hot unmount marker
-                        if (fs::exists("/data/adb/hymo/run/hot_unmounted/" + mod.id)) {
-                            LOG_INFO("Skipping hot-unmounted module: " + mod.id);
-                            continue;
-                        }
-
-                        bool has_content = false;
-                        for (const auto& part : all_partitions) {
-                            if (has_files_recursive(mod.source_path / part)) {
-                                has_content = true;
-                                break;
-                            }
-                        }
-                        if (has_content) active_modules.push_back(mod);
-                    }
-                    module_list = active_modules;
-
-                    // 3. Sync to mirror
-                    LOG_INFO("Syncing modules to mirror...");
-                    for (const auto& mod : module_list) {
-                        fs::path src = config.moduledir / mod.id;
-                        fs::path dst = MIRROR_DIR / mod.id;
-                        sync_dir(src, dst);
-                    }
-                    
-                    // 4. Update mappings
-                    MountPlan plan = generate_plan(config, module_list, MIRROR_DIR);
-                    update_hymofs_mappings(config, module_list, MIRROR_DIR, plan);
-                    
-                    // Apply Stealth Mode
-                    if (HymoFS::set_stealth(config.enable_stealth)) {
-                        LOG_INFO("Stealth mode set to: " + std::string(config.enable_stealth ? "true" : "false"));
-                    } else {
-                        LOG_WARN("Failed to set stealth mode.");
-                    }
-
-                    // 5. Update Runtime State (daemon_state.json)
-                    RuntimeState state = load_runtime_state();
-                    
-                    if (state.storage_mode.empty()) {
-                        state.storage_mode = "hymofs";
-                    }
-                    state.mount_point = MIRROR_DIR.string();
-                    state.hymofs_module_ids = plan.hymofs_module_ids;
-                    
-                    // Recalculate active mounts for HymoFS
-                    state.active_mounts.clear();
-                    std::vector<std::string> all_parts = BUILTIN_PARTITIONS;
-                    for(const auto& p : config.partitions) all_parts.push_back(p);
-                    
-                    for (const auto& part : all_parts) {
-                        bool active = false;
-                        for (const auto& mod_id : plan.hymofs_module_ids) {
-                            for (const auto& m : module_list) {
-                                if (m.id == mod_id) {
-                                    if (fs::exists(m.source_path / part)) {
-                                        active = true;
-                                        break;
-                                    }
-                                }
-                            }
-                            if (active) break;
-                        }
-                        if (active) state.active_mounts.push_back(part);
-                    }
-                    
-                    state.save();
-
-                    LOG_INFO("Reload complete.");
+                    reload_hymofs(config, cli.module.empty() ? std::set<std::string>() : std::set<std::string>{cli.module});
                 } else {
                     LOG_WARN("HymoFS not available, cannot hot reload.");
                 }
                 return 0;
+            } else if (cli.command == "watch") {
+                Config config = load_config(cli);
+                Logger::getInstance().init(config.verbose, DAEMON_LOG_FILE);
+                if (!HymoFS::is_available()) {
+                    std::cerr << "HymoFS not available.\n";
+                    return 1;
+                }
+
+                fs::path config_file = cli.config_file.empty() ? fs::path(BASE_DIR) / "config.toml" : fs::path(cli.config_file);
+                ModuleWatcher watcher(config.moduledir, config_file);
+                if (!watcher.start()) {
+                    return 1;
+                }
+                WatchChanges changes;
+                while (watcher.wait(changes)) {
+                    // Every reload starts from the saved index, as a fresh hymod would
+                    ModuleIndex::global().clear();
+                    if (changes.config) {
+                        LOG_INFO("Configuration changed");
+                        config = load_config(cli);
+                        reload_hymofs(config, {});
+                    } else {
+                        reload_hymofs(config, changes.modules);
+                    }
+                }
+                return 1;
             } else if (cli.command != "mount") {
                 std::cerr << "Unknown command: " << cli.command << "\n";
                 print_help();
@@ -670,6 +1143,7 @@ int main(int argc, char* argv[]) {
         
         // Load and merge configuration
         Config config = load_config(cli);
+        fs::path config_file = cli.config_file.empty() ? fs::path(BASE_DIR) / "config.toml" : fs::path(cli.config_file);
         config.merge_with_cli(cli.moduledir, cli.tempdir, cli.mountsource, cli.verbose, cli.partitions);
         
         // Re-initialize logger with merged config
@@ -689,6 +1163,9 @@ int main(int argc, char* argv[]) {
         // Ensure runtime directory exists
         ensure_dir_exists(RUN_DIR);
 
+        // Module trees from the last boot; only directories that changed since are read again
+        ModuleIndex::global().load(MODULE_INDEX_FILE);
+
         StorageHandle storage;
         MountPlan plan;
         ExecutionResult exec_result;
@@ -745,17 +1222,23 @@ int main(int argc, char* argv[]) {
                 // Reuse setup_storage to handle Tmpfs -> Ext4 fallback
                 // We pass config.force_ext4 to respect user setting
                 try {
-                    storage = setup_storage(MIRROR_DIR, img_path, config.force_ext4);
+                    storage = setup_storage(MIRROR_DIR, img_path, config, config.mirror_backend);
                 } catch (const std::exception& e) {
                     if (config.force_ext4) {
                         LOG_WARN("Force Ext4 failed: " + std::string(e.what()) + ". Falling back to auto (Tmpfs/Ext4).");
-                        storage = setup_storage(MIRROR_DIR, img_path, false);
+                        Config auto_config = config;
+                        auto_config.force_ext4 = false;
+                        storage = setup_storage(MIRROR_DIR, img_path, auto_config, config.mirror_backend);
                     } else {
                         throw;
                     }
                 }
                 LOG_INFO("Mirror storage setup successful. Mode: " + storage.mode);
 
+                // An ext4 mirror keeps last boot's segregated sources; nothing is mounted
+                // from them yet, so drop them and let sync restore the module trees
+                reset_mirror_staging(MIRROR_DIR);
+
                 // Scan modules from source to know what to copy
                 module_list = scan_modules(config.moduledir, config);
                 
@@ -767,7 +1250,7 @@ int main(int argc, char* argv[]) {
                 for (const auto& mod : module_list) {
                     bool has_content = false;
                     for (const auto& part : all_partitions) {
-                        if (has_files_recursive(mod.source_path / part)) {
+                        if (ModuleIndex::global().get(mod.id, mod.source_path).has_files(part)) {
                             has_content = true;
                             break;
                         }
@@ -784,15 +1267,7 @@ int main(int argc, char* argv[]) {
 
                 LOG_INFO("Syncing " + std::to_string(module_list.size()) + " active modules to mirror...");
                 
-                bool sync_ok = true;
-                for (const auto& mod : module_list) {
-                    fs::path src = config.moduledir / mod.id;
-                    fs::path dst = MIRROR_DIR / mod.id;
-                    if (!sync_dir(src, dst)) {
-                        LOG_ERROR("Failed to sync module: " + mod.id);
-                        sync_ok = false;
-                    }
-                }
+                bool sync_ok = sync_modules_to_mirror(module_list, MIRROR_DIR, config, storage.mode);
                 
                 if (sync_ok) {
                     // If using ext4 image, we need to fix permissions after sync
@@ -805,20 +1280,38 @@ int main(int argc, char* argv[]) {
                     // storage.mode = "hymofs"; // Keep real mode (tmpfs/ext4)
                     storage.mount_point = MIRROR_DIR;
                     
-                    // Generate plan from MIRROR
-                    plan = generate_plan(config, module_list, MIRROR_DIR);
+                    // Generate plan from MIRROR, or replay last boot's if no input changed
+                    uint64_t fingerprint = config.plan_cache
+                        ? plan_fingerprint(config, config_file, module_list, MIRROR_DIR) : 0;
+                    HymoRules rules;
+                    bool replayed = fingerprint != 0 && load_plan_cache(fingerprint, plan, rules);
+                    if (replayed) {
+                        LOG_INFO("Inputs unchanged since last boot, replaying cached plan and HymoFS rules");
+                    } else {
+                        plan = generate_plan(config, module_list, MIRROR_DIR);
+                    }
+                    // The cache keeps the plan before segregation, which moves its sources
+                    MountPlan unsegregated = plan;
                     
                     // Segregate custom rules (Overlay/Magic) to prevent HymoFS interference
                     segregate_custom_rules(plan, MIRROR_DIR);
 
                     // Update Kernel Mappings using MIRROR paths
-                    update_hymofs_mappings(config, module_list, MIRROR_DIR, plan);
+                    if (!replayed) {
+                        HymoConflictReport report;
+                        rules = build_hymofs_rules(config, module_list, MIRROR_DIR, plan, &report);
+                        save_conflict_report(report);
+                        if (fingerprint != 0) {
+                            save_plan_cache(fingerprint, unsegregated, rules);
+                        }
+                    }
+                    apply_hymofs_rules(rules);
                     
                     // Execute plan
                     exec_result = execute_plan(plan, config);
                 } else {
                     LOG_ERROR("Mirror sync failed. Aborting mirror strategy.");
-                    umount(MIRROR_DIR.c_str());
+                    umount2(MIRROR_DIR.c_str(), MNT_DETACH);
                 }
 
             } catch (const std::exception& e) {
@@ -846,7 +1339,7 @@ int main(int argc, char* argv[]) {
                     for (const auto& part : config.partitions) all_partitions.push_back(part);
                     
                     for (const auto& part : all_partitions) {
-                        if (has_files_recursive(mod.source_path / part)) {
+                        if (ModuleIndex::global().get(mod.id, mod.source_path).has_files(part)) {
                             has_content = true;
                             break;
                         }
@@ -878,7 +1371,7 @@ int main(int argc, char* argv[]) {
             fs::path mnt_base(FALLBACK_CONTENT_DIR);
             fs::path img_path = fs::path(BASE_DIR) / "modules.img";
             
-            storage = setup_storage(mnt_base, img_path, config.force_ext4);
+            storage = setup_storage(mnt_base, img_path, config);
             
             // **Step 2: Scan Modules**
             module_list = scan_modules(config.moduledir, config);
@@ -893,8 +1386,18 @@ int main(int argc, char* argv[]) {
             }
             
             // **Step 4: Generate Plan**
-            LOG_INFO("Generating mount plan...");
-            plan = generate_plan(config, module_list, storage.mount_point);
+            uint64_t fingerprint = config.plan_cache
+                ? plan_fingerprint(config, config_file, module_list, storage.mount_point) : 0;
+            HymoRules rules;
+            if (fingerprint != 0 && load_plan_cache(fingerprint, plan, rules)) {
+                LOG_INFO("Inputs unchanged since last boot, replaying cached mount plan");
+            } else {
+                LOG_INFO("Generating mount plan...");
+                plan = generate_plan(config, module_list, storage.mount_point);
+                if (fingerprint != 0) {
+                    save_plan_cache(fingerprint, plan, rules);
+                }
+            }
             
             // **Step 5: Execute Plan**
             exec_result = execute_plan(plan, config);
@@ -1015,6 +1518,9 @@ int main(int argc, char* argv[]) {
         if (!state.save()) {
             LOG_ERROR("Failed to save runtime state");
         }
+        if (!ModuleIndex::global().save(MODULE_INDEX_FILE)) {
+            LOG_WARN("Failed to save module index");
+        }
         
         // Update module description
         update_module_description(
@@ -1,13 +1,20 @@
 #include "hymofs.hpp"
 #include "../utils.hpp"
+#include "../walker.hpp"
+#include "../core/rule_trie.hpp"
+#include "../core/planner.hpp"
 #include <fstream>
 #include <iostream>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <cerrno>
 #include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
 
 namespace hymo {
 
@@ -36,18 +43,205 @@ struct hymo_ioctl_list_arg {
 #define HYMO_IOC_SET_STEALTH _IOW(HYMO_IOC_MAGIC, 10, int)
 #define HYMO_IOC_HIDE_OVERLAY_XATTRS _IOW(HYMO_IOC_MAGIC, 11, struct hymo_ioctl_arg)
 
+// Batched add/delete/hide, protocol 5+. Records are packed back to back; each is
+// followed by src and target (NUL-terminated) and padded to 8 bytes. The kernel
+// applies them in order and stops at the first failure, returning its error and
+// the number of records applied before it.
+#define HYMO_BATCH_PROTOCOL_VERSION 5
+#define HYMO_BATCH_ADD  1
+#define HYMO_BATCH_DEL  2
+#define HYMO_BATCH_HIDE 3
+
+// Optional features, as a bit mask returned directly. Kernels that predate the
+// query answer ENOTTY, i.e. none of them.
+#define HYMO_IOC_GET_FEATURES _IO(HYMO_IOC_MAGIC, 13)
+// Directory redirects: an add rule with type DT_DIR makes the virtual directory
+// resolve to the target directory, everything below it included. Not implied by
+// any protocol version; a kernel without it may take a DT_DIR add as a file rule.
+#define HYMO_FEATURE_DIR_RULES (1 << 0)
+
+struct hymo_batch_record {
+    uint16_t op;
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t src_len;    // without the NUL
+    uint32_t target_len; // without the NUL, 0 unless op is ADD
+    uint32_t reclen;     // header, strings and padding
+};
+
+struct hymo_ioctl_batch_arg {
+    const char *buf;
+    size_t size;
+    unsigned int count;
+    unsigned int applied;
+};
+#define HYMO_IOC_BATCH _IOWR(HYMO_IOC_MAGIC, 12, struct hymo_ioctl_batch_arg)
+
+namespace {
+
+// File-backed stand-in for the control device (see HymoFS::simulate_device)
+struct SimDevice {
+    bool checked_env = false;
+    std::string path;
+    int protocol = HYMO_BATCH_PROTOCOL_VERSION;
+    int features = 0;
+};
+
+SimDevice& sim() {
+    static SimDevice dev;
+    if (!dev.checked_env) {
+        dev.checked_env = true;
+        if (const char* env = getenv("HYMO_SIM_DEV"); env && *env) {
+            dev.path = env;
+            if (const char* ver = getenv("HYMO_SIM_PROTOCOL"); ver && *ver) {
+                dev.protocol = atoi(ver);
+            }
+            if (const char* features = getenv("HYMO_SIM_FEATURES"); features && *features) {
+                dev.features = atoi(features);
+            }
+        }
+    }
+    return dev;
+}
+
+int open_ctl(int flags) {
+    if (!sim().path.empty()) {
+        return open(sim().path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    }
+    return open(HYMO_DEV, flags | O_CLOEXEC);
+}
+
+// Walk packed batch records; false on a malformed buffer
+template <typename Fn>
+bool for_each_record(const char* buf, size_t size, unsigned int count, Fn&& fn) {
+    size_t off = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        if (size - off < sizeof(hymo_batch_record)) return false;
+        hymo_batch_record rec;
+        memcpy(&rec, buf + off, sizeof(rec));
+        uint64_t strings = (uint64_t)rec.src_len + 1 + (rec.op == HYMO_BATCH_ADD ? (uint64_t)rec.target_len + 1 : 0);
+        if (rec.reclen % 8 != 0 || rec.reclen > size - off || rec.reclen < sizeof(rec) + strings) return false;
+
+        const char* src = buf + off + sizeof(rec);
+        const char* target = rec.op == HYMO_BATCH_ADD ? src + rec.src_len + 1 : nullptr;
+        if (src[rec.src_len] != '\0' || (target && target[rec.target_len] != '\0')) return false;
+        if (!fn(i, rec.op, src, target, (int)rec.type)) return true;
+        off += rec.reclen;
+    }
+    return off == size;
+}
+
+bool sim_write(int fd, const std::string& text) {
+    return write(fd, text.data(), text.size()) == (ssize_t)text.size();
+}
+
+std::string sim_line(int op, const char* src, const char* target, int type) {
+    switch (op) {
+        case HYMO_BATCH_ADD: return "add " + std::string(src) + " " + target + " " + std::to_string(type) + "\n";
+        case HYMO_BATCH_DEL: return "del " + std::string(src) + "\n";
+        default: return "hide " + std::string(src) + "\n";
+    }
+}
+
+int sim_record(int fd, int op, const char* src, const char* target, int type) {
+    if (!src || !*src || (op == HYMO_BATCH_ADD && (!target || !*target))) {
+        errno = EINVAL;
+        return -1;
+    }
+    return sim_write(fd, sim_line(op, src, target, type)) ? 0 : -1;
+}
+
+int sim_ioctl(int fd, unsigned long request, void* arg) {
+    auto* rule = static_cast<hymo_ioctl_arg*>(arg);
+    switch (request) {
+        case HYMO_IOC_GET_VERSION:
+            return sim().protocol;
+        case HYMO_IOC_GET_FEATURES:
+            if (sim().features == 0) break;
+            return sim().features;
+        case HYMO_IOC_CLEAR_ALL:
+            return ftruncate(fd, 0);
+        case HYMO_IOC_ADD_RULE:
+            return sim_record(fd, HYMO_BATCH_ADD, rule->src, rule->target, rule->type);
+        case HYMO_IOC_DEL_RULE:
+            return sim_record(fd, HYMO_BATCH_DEL, rule->src, nullptr, 0);
+        case HYMO_IOC_HIDE_RULE:
+            return sim_record(fd, HYMO_BATCH_HIDE, rule->src, nullptr, 0);
+        case HYMO_IOC_SET_DEBUG:
+        case HYMO_IOC_SET_STEALTH:
+        case HYMO_IOC_REORDER_MNT_ID:
+        case HYMO_IOC_HIDE_OVERLAY_XATTRS:
+            return 0;
+        case HYMO_IOC_BATCH: {
+            if (sim().protocol < HYMO_BATCH_PROTOCOL_VERSION) break;
+            auto* batch = static_cast<hymo_ioctl_batch_arg*>(arg);
+            // Validate everything first, then log the applied records in one write
+            std::string text;
+            int err = 0;
+            batch->applied = 0;
+            bool valid = for_each_record(batch->buf, batch->size, batch->count,
+                                         [&](unsigned int i, int op, const char* src, const char* target, int type) {
+                if (!*src || (op == HYMO_BATCH_ADD && !*target) || op < HYMO_BATCH_ADD || op > HYMO_BATCH_HIDE) {
+                    err = EINVAL;
+                    return false;
+                }
+                text += sim_line(op, src, target, type);
+                batch->applied = i + 1;
+                return true;
+            });
+            if (!valid) {
+                batch->applied = 0;
+                errno = EINVAL;
+                return -1;
+            }
+            if (!text.empty() && !sim_write(fd, text)) return -1;
+            if (err) {
+                errno = err;
+                return -1;
+            }
+            return 0;
+        }
+    }
+    errno = ENOTTY;
+    return -1;
+}
+
+int ctl_ioctl(int fd, unsigned long request, void* arg = nullptr) {
+    if (!sim().path.empty()) {
+        return sim_ioctl(fd, request, arg);
+    }
+    return ioctl(fd, request, arg);
+}
+
+} // namespace
+
+void HymoFS::simulate_device(const fs::path& file, int protocol_version) {
+    SimDevice& dev = sim();
+    dev.path = file.string();
+    dev.protocol = protocol_version;
+}
+
 int HymoFS::get_protocol_version() {
-    int fd = open(HYMO_DEV, O_RDONLY);
+    int fd = open_ctl(O_RDONLY);
     if (fd < 0) return -1;
     
-    int version = ioctl(fd, HYMO_IOC_GET_VERSION);
+    int version = ctl_ioctl(fd, HYMO_IOC_GET_VERSION);
     close(fd);
     
     // Kernel implementation returns the version directly
     return version;
 }
 
+bool HymoFS::supports_dir_rules() {
+    int fd = open_ctl(O_RDONLY);
+    if (fd < 0) return false;
+    int features = ctl_ioctl(fd, HYMO_IOC_GET_FEATURES);
+    close(fd);
+    return features > 0 && (features & HYMO_FEATURE_DIR_RULES);
+}
+
 HymoFSStatus HymoFS::check_status() {
+    if (!sim().path.empty()) return HymoFSStatus::Available;
     if (!fs::exists(HYMO_DEV)) return HymoFSStatus::NotPresent;
     
     // Assume available if device exists
@@ -59,15 +253,15 @@ bool HymoFS::is_available() {
 }
 
 bool HymoFS::clear_rules() {
-    int fd = open(HYMO_DEV, O_RDWR);
+    int fd = open_ctl(O_RDWR);
     if (fd < 0) return false;
-    int ret = ioctl(fd, HYMO_IOC_CLEAR_ALL);
+    int ret = ctl_ioctl(fd, HYMO_IOC_CLEAR_ALL);
     close(fd);
     return ret == 0;
 }
 
 bool HymoFS::add_rule(const std::string& src, const std::string& target, int type) {
-    int fd = open(HYMO_DEV, O_RDWR);
+    int fd = open_ctl(O_RDWR);
     if (fd < 0) return false;
     
     struct hymo_ioctl_arg arg = {
@@ -76,13 +270,13 @@ bool HymoFS::add_rule(const std::string& src, const std::string& target, int typ
         .type = (unsigned char)type
     };
     
-    int ret = ioctl(fd, HYMO_IOC_ADD_RULE, &arg);
+    int ret = ctl_ioctl(fd, HYMO_IOC_ADD_RULE, &arg);
     close(fd);
     return ret == 0;
 }
 
 bool HymoFS::delete_rule(const std::string& src) {
-    int fd = open(HYMO_DEV, O_RDWR);
+    int fd = open_ctl(O_RDWR);
     if (fd < 0) return false;
     
     struct hymo_ioctl_arg arg = {
@@ -91,13 +285,13 @@ bool HymoFS::delete_rule(const std::string& src) {
         .type = 0
     };
     
-    int ret = ioctl(fd, HYMO_IOC_DEL_RULE, &arg);
+    int ret = ctl_ioctl(fd, HYMO_IOC_DEL_RULE, &arg);
     close(fd);
     return ret == 0;
 }
 
 bool HymoFS::hide_path(const std::string& path) {
-    int fd = open(HYMO_DEV, O_RDWR);
+    int fd = open_ctl(O_RDWR);
     if (fd < 0) return false;
     
     struct hymo_ioctl_arg arg = {
@@ -106,35 +300,73 @@ bool HymoFS::hide_path(const std::string& path) {
         .type = 0
     };
     
-    int ret = ioctl(fd, HYMO_IOC_HIDE_RULE, &arg);
+    int ret = ctl_ioctl(fd, HYMO_IOC_HIDE_RULE, &arg);
     close(fd);
     return ret == 0;
 }
 
-bool HymoFS::add_rules_from_directory(const fs::path& target_base, const fs::path& module_dir) {
+// A directory whose whole subtree can be served by one DT_DIR rule: only directories,
+// regular files and symlinks (no whiteouts or devices to hide), and more than one file
+static bool dir_rule_candidate(const fs::path& dir) {
+    size_t files = 0;
+    bool clean = true;
+    std::error_code ec = walk_tree(dir, [&](const WalkEntry& entry) {
+        if (S_ISREG(entry.st.st_mode) || S_ISLNK(entry.st.st_mode)) {
+            files++;
+        } else if (!S_ISDIR(entry.st.st_mode)) {
+            clean = false;
+            return WalkAction::Stop;
+        }
+        return WalkAction::Continue;
+    });
+    return !ec && clean && files > 1;
+}
+
+bool HymoFS::add_rules_from_directory(const fs::path& target_base, const fs::path& module_dir, bool compact,
+                                      const RuleTrie* rules, HymoRules* added) {
     if (!fs::exists(module_dir) || !fs::is_directory(module_dir)) return false;
 
-    try {
-        for (const auto& entry : fs::recursive_directory_iterator(module_dir)) {
-            const fs::path& current_path = entry.path();
-            
-            // Calculate relative path from module root
-            fs::path rel_path = fs::relative(current_path, module_dir);
-            fs::path target_path = target_base / rel_path;
-            
-            if (entry.is_regular_file() || entry.is_symlink()) {
-                // For symlinks, we also just redirect the path to the symlink file in the module
-                add_rule(target_path.string(), current_path.string());
-            } else if (entry.is_character_file()) {
-                // Check for whiteout (0:0)
-                struct stat st;
-                if (stat(current_path.c_str(), &st) == 0 && st.st_rdev == 0) {
-                    hide_path(target_path.string());
-                }
+    compact = compact && supports_dir_rules();
+    auto other_mode = [](const std::string& mode) { return mode != "hymofs" && mode != "auto"; };
+    HymoFSSession session;
+    std::error_code ec = walk_tree(module_dir, [&](const WalkEntry& entry) {
+        fs::path target_path = target_base / entry.rel;
+        if (rules) {
+            RuleTrie::Match match = rules->match(target_path.string());
+            if (match.mode && other_mode(*match.mode)) {
+                return WalkAction::Continue;
+            }
+        }
+        
+        if (S_ISREG(entry.st.st_mode) || S_ISLNK(entry.st.st_mode)) {
+            // For symlinks, we also just redirect the path to the symlink file in the module
+            session.add_rule(target_path.string(), entry.path().string());
+            if (added) {
+                added->add_rules.push_back(
+                    {target_path.string(), entry.path().string(), S_ISREG(entry.st.st_mode) ? DT_REG : DT_LNK});
+            }
+        } else if (S_ISCHR(entry.st.st_mode) && entry.st.st_rdev == 0) {
+            // Whiteout (0:0)
+            session.hide_path(target_path.string());
+            if (added) added->hide_rules.push_back(target_path.string());
+        } else if (compact && S_ISDIR(entry.st.st_mode) && !entry.rel.empty()) {
+            // Nothing on the system to merge with: redirect the directory as a whole
+            struct stat st;
+            if (lstat(target_path.c_str(), &st) != 0 && errno == ENOENT && dir_rule_candidate(entry.path()) &&
+                !(rules && rules->any_at_or_below(target_path.string(), other_mode))) {
+                session.add_rule(target_path.string(), entry.path().string(), DT_DIR);
+                if (added) added->add_rules.push_back({target_path.string(), entry.path().string(), DT_DIR});
+                return WalkAction::SkipSubtree;
             }
         }
-    } catch (const std::exception& e) {
-        LOG_WARN("HymoFS rule generation error for " + module_dir.string() + ": " + e.what());
+        return WalkAction::Continue;
+    });
+    if (ec) {
+        LOG_WARN("HymoFS rule generation error for " + module_dir.string() + ": " + ec.message());
+        return false;
+    }
+    if (added && (!session.flush() || session.failures() > 0)) {
+        LOG_WARN("HymoFS rejected rules for " + module_dir.string());
         return false;
     }
     return true;
@@ -143,70 +375,176 @@ bool HymoFS::add_rules_from_directory(const fs::path& target_base, const fs::pat
 bool HymoFS::remove_rules_from_directory(const fs::path& target_base, const fs::path& module_dir) {
     if (!fs::exists(module_dir) || !fs::is_directory(module_dir)) return false;
 
-    try {
-        for (const auto& entry : fs::recursive_directory_iterator(module_dir)) {
-            const fs::path& current_path = entry.path();
-            
-            // Calculate relative path from module root
-            fs::path rel_path = fs::relative(current_path, module_dir);
-            fs::path target_path = target_base / rel_path;
-            
-            if (entry.is_regular_file() || entry.is_symlink()) {
-                // Delete rule for this file
-                delete_rule(target_path.string());
-            } else if (entry.is_character_file()) {
-                // Check for whiteout (0:0)
-                struct stat st;
-                if (stat(current_path.c_str(), &st) == 0 && st.st_rdev == 0) {
-                    delete_rule(target_path.string());
-                }
-            }
+    bool dir_rules = supports_dir_rules();
+    HymoFSSession session;
+    std::error_code ec = walk_tree(module_dir, [&](const WalkEntry& entry) {
+        fs::path target_path = target_base / entry.rel;
+        
+        if (S_ISREG(entry.st.st_mode) || S_ISLNK(entry.st.st_mode) ||
+            (S_ISCHR(entry.st.st_mode) && entry.st.st_rdev == 0)) {
+            // Delete rule for this file or whiteout
+            session.delete_rule(target_path.string());
+        } else if (dir_rules && S_ISDIR(entry.st.st_mode) && !entry.rel.empty() &&
+                   dir_rule_candidate(entry.path())) {
+            // May have been added as one directory rule; the file rules below are
+            // deleted too in case it was not
+            session.delete_rule(target_path.string());
         }
-    } catch (const std::exception& e) {
-        LOG_WARN("HymoFS rule removal error for " + module_dir.string() + ": " + e.what());
+        return WalkAction::Continue;
+    });
+    if (ec) {
+        LOG_WARN("HymoFS rule removal error for " + module_dir.string() + ": " + ec.message());
         return false;
     }
     return true;
 }
 
-std::string HymoFS::get_active_rules() {
-    int fd = open(HYMO_DEV, O_RDONLY);
-    if (fd < 0) return "Error: Cannot open " + std::string(HYMO_CTL_DEV) + "\n";
-    
-    size_t buf_size = 128 * 1024; // 128KB buffer
-    char* raw_buf = (char*)malloc(buf_size);
-    if (!raw_buf) {
-        close(fd);
-        return "Error: Out of memory\n";
-    }
-    memset(raw_buf, 0, buf_size);
-    
-    ssize_t bytes_read = read(fd, raw_buf, buf_size - 1);
-    if (bytes_read < 0) {
-        std::string err = "Error: read failed: ";
-        err += strerror(errno);
-        err += "\n";
-        free(raw_buf);
-        close(fd);
-        return err;
+// Feed the device's rule listing to fn as it is read. Devices that keep a file
+// position are read until EOF. One that doesn't (position 0 or unknown after a
+// read) returns the list from the start on every read: a first read that leaves
+// room in the buffer holds all of it, a full one may be cut off and is dropped.
+// Then, or without read() support, HYMO_IOC_LIST_RULES is asked with a buffer
+// grown until the list fits.
+static bool read_rule_listing(const std::function<bool(const char*, size_t)>& fn) {
+    int fd = open_ctl(O_RDONLY);
+    if (fd < 0) return false;
+
+    constexpr size_t CHUNK = 64 * 1024;
+    std::vector<char> buf(CHUNK);
+    bool first = true;
+    for (;;) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && first && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            break;
+        }
+        if (n <= 0) {
+            close(fd);
+            return n == 0;
+        }
+        if (first) {
+            first = false;
+            off_t pos = lseek(fd, 0, SEEK_CUR);
+            if (pos <= 0) {
+                if ((size_t)n == buf.size()) break;
+                fn(buf.data(), n);
+                close(fd);
+                return true;
+            }
+        }
+        if (!fn(buf.data(), n)) {
+            close(fd);
+            return true;
+        }
     }
-    
-    std::string result(raw_buf, bytes_read);
 
-    free(raw_buf);
+    constexpr size_t LIST_MAX = 256 * 1024 * 1024;
+    for (size_t size = 1024 * 1024; size <= LIST_MAX; size *= 2) {
+        buf.assign(size, '\0');
+        struct hymo_ioctl_list_arg arg = {
+            .buf = buf.data(),
+            .size = size
+        };
+        if (ctl_ioctl(fd, HYMO_IOC_LIST_RULES, &arg) < 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return false;
+        }
+        size_t len = strnlen(buf.data(), size);
+        if (len < size - 1) {
+            fn(buf.data(), len);
+            close(fd);
+            return true;
+        }
+    }
+    // Larger than LIST_MAX: report it rather than an empty list
     close(fd);
+    LOG_WARN("HymoFS rule list does not fit in " + std::to_string(LIST_MAX >> 20) + " MiB");
+    errno = EOVERFLOW;
+    return false;
+}
+
+std::string HymoFS::get_active_rules() {
+    std::string result;
+    bool ok = read_rule_listing([&](const char* data, size_t len) {
+        result.append(data, len);
+        return true;
+    });
+    if (!ok && result.empty()) {
+        return "Error: Cannot read rules from " + std::string(HYMO_CTL_DEV) + ": " + strerror(errno) + "\n";
+    }
     return result;
 }
 
+// "add <src> <target> [type]" or "<kind> <path>"; anything else (headers) is skipped
+static bool parse_rule_line(const char* line, size_t len, HymoRuleEntry& out) {
+    std::vector<std::pair<size_t, size_t>> tokens;
+    for (size_t i = 0; i < len;) {
+        while (i < len && line[i] == ' ') i++;
+        size_t start = i;
+        while (i < len && line[i] != ' ') i++;
+        if (i > start) tokens.emplace_back(start, i - start);
+    }
+    // Rules name an absolute path right after their kind; headers don't
+    if (tokens.size() < 2 || line[tokens[1].first] != '/') return false;
+
+    out.kind.assign(line + tokens[0].first, tokens[0].second);
+    if (out.kind == "add") {
+        if (tokens.size() < 3) return false;
+        out.src.assign(line + tokens[1].first, tokens[1].second);
+        out.target.assign(line + tokens[2].first, tokens[2].second);
+        out.type = tokens.size() > 3 ? atoi(line + tokens[3].first) : 0;
+    } else {
+        // Path is the rest of the line, spaces included
+        size_t start = tokens[1].first;
+        out.src.assign(line + start, len - start);
+        out.target.clear();
+        out.type = 0;
+    }
+    return true;
+}
+
+bool HymoFS::list_rules(const std::function<bool(const HymoRuleEntry&)>& fn) {
+    std::string partial; // line split across two chunks
+    HymoRuleEntry entry;
+    bool stopped = false;
+    auto emit = [&](const char* line, size_t len) {
+        if (len > 0 && line[len - 1] == '\r') len--;
+        if (parse_rule_line(line, len, entry) && !fn(entry)) stopped = true;
+    };
+
+    bool ok = read_rule_listing([&](const char* data, size_t len) {
+        size_t start = 0;
+        for (const char* nl; !stopped && (nl = (const char*)memchr(data + start, '\n', len - start));) {
+            size_t end = nl - data;
+            if (partial.empty()) {
+                emit(data + start, end - start);
+            } else {
+                partial.append(data + start, end - start);
+                emit(partial.data(), partial.size());
+                partial.clear();
+            }
+            start = end + 1;
+        }
+        if (!stopped) partial.append(data + start, len - start);
+        return !stopped;
+    });
+    if (ok && !stopped && !partial.empty()) {
+        emit(partial.data(), partial.size());
+    }
+    return ok;
+}
+
 bool HymoFS::set_debug(bool enable) {
-    int fd = open(HYMO_DEV, O_RDWR);
+    int fd = open_ctl(O_RDWR);
     if (fd < 0) {
         perror("HymoFS: Failed to open device");
         return false;
     }
     
     int val = enable ? 1 : 0;
-    int ret = ioctl(fd, HYMO_IOC_SET_DEBUG, &val);
+    int ret = ctl_ioctl(fd, HYMO_IOC_SET_DEBUG, &val);
     if (ret != 0) {
         perror("HymoFS: Failed to set debug mode");
     }
@@ -215,14 +553,14 @@ bool HymoFS::set_debug(bool enable) {
 }
 
 bool HymoFS::set_stealth(bool enable) {
-    int fd = open(HYMO_DEV, O_RDWR);
+    int fd = open_ctl(O_RDWR);
     if (fd < 0) {
         perror("HymoFS: Failed to open device");
         return false;
     }
     
     int val = enable ? 1 : 0;
-    int ret = ioctl(fd, HYMO_IOC_SET_STEALTH, &val);
+    int ret = ctl_ioctl(fd, HYMO_IOC_SET_STEALTH, &val);
     if (ret != 0) {
         perror("HymoFS: Failed to set stealth mode");
     }
@@ -231,7 +569,7 @@ bool HymoFS::set_stealth(bool enable) {
 }
 
 bool HymoFS::hide_overlay_xattrs(const std::string& path) {
-    int fd = open(HYMO_DEV, O_RDWR);
+    int fd = open_ctl(O_RDWR);
     if (fd < 0) return false;
     
     struct hymo_ioctl_arg arg = {
@@ -240,9 +578,140 @@ bool HymoFS::hide_overlay_xattrs(const std::string& path) {
         .type = 0
     };
     
-    int ret = ioctl(fd, HYMO_IOC_HIDE_OVERLAY_XATTRS, &arg);
+    int ret = ctl_ioctl(fd, HYMO_IOC_HIDE_OVERLAY_XATTRS, &arg);
     close(fd);
     return ret == 0;
 }
 
+HymoFSSession::HymoFSSession() {
+    fd_ = open_ctl(O_RDWR);
+    if (fd_ < 0) return;
+    batching_ = ctl_ioctl(fd_, HYMO_IOC_GET_VERSION) >= HYMO_BATCH_PROTOCOL_VERSION;
+}
+
+HymoFSSession::~HymoFSSession() {
+    if (fd_ < 0) return;
+    flush();
+    close(fd_);
+}
+
+bool HymoFSSession::add_rule(const std::string& src, const std::string& target, int type) {
+    return submit(HYMO_BATCH_ADD, src, &target, type);
+}
+
+bool HymoFSSession::delete_rule(const std::string& src) {
+    return submit(HYMO_BATCH_DEL, src, nullptr, 0);
+}
+
+bool HymoFSSession::hide_path(const std::string& path) {
+    return submit(HYMO_BATCH_HIDE, path, nullptr, 0);
+}
+
+bool HymoFSSession::clear() {
+    bool ok = flush();
+    if (fd_ < 0) return false;
+    ioctls_++;
+    return ctl_ioctl(fd_, HYMO_IOC_CLEAR_ALL) == 0 && ok;
+}
+
+bool HymoFSSession::send_single(int op, const char* src, const char* target, int type) {
+    struct hymo_ioctl_arg arg = {
+        .src = src,
+        .target = target,
+        .type = (unsigned char)type
+    };
+    unsigned long request = op == HYMO_BATCH_ADD ? HYMO_IOC_ADD_RULE
+                          : op == HYMO_BATCH_DEL ? HYMO_IOC_DEL_RULE : HYMO_IOC_HIDE_RULE;
+    ioctls_++;
+    if (ctl_ioctl(fd_, request, &arg) != 0) {
+        failures_++;
+        flush_failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool HymoFSSession::submit(int op, const std::string& src, const std::string* target, int type) {
+    if (fd_ < 0) {
+        failures_++;
+        return false;
+    }
+    records_++;
+    if (!batching_) {
+        return send_single(op, src.c_str(), target ? target->c_str() : nullptr, type);
+    }
+
+    size_t strings = src.size() + 1 + (target ? target->size() + 1 : 0);
+    size_t reclen = (sizeof(hymo_batch_record) + strings + 7) & ~(size_t)7;
+    if (!batch_.empty() && batch_.size() + reclen > BATCH_BYTES) {
+        flush();
+    }
+
+    hymo_batch_record rec = {};
+    rec.op = op;
+    rec.type = (uint8_t)type;
+    rec.src_len = src.size();
+    rec.target_len = target ? target->size() : 0;
+    rec.reclen = reclen;
+
+    size_t off = batch_.size();
+    batch_.resize(off + reclen, '\0');
+    memcpy(batch_.data() + off, &rec, sizeof(rec));
+    memcpy(batch_.data() + off + sizeof(rec), src.c_str(), src.size() + 1);
+    if (target) {
+        memcpy(batch_.data() + off + sizeof(rec) + src.size() + 1, target->c_str(), target->size() + 1);
+    }
+    batch_count_++;
+    return true;
+}
+
+bool HymoFSSession::flush() {
+    size_t off = 0;
+    unsigned int sent = 0;
+    while (batching_ && sent < batch_count_) {
+        struct hymo_ioctl_batch_arg arg = {
+            .buf = batch_.data() + off,
+            .size = batch_.size() - off,
+            .count = batch_count_ - sent,
+            .applied = 0
+        };
+        ioctls_++;
+        if (ctl_ioctl(fd_, HYMO_IOC_BATCH, &arg) == 0) {
+            sent = batch_count_;
+            break;
+        }
+        if (errno == ENOTTY && arg.applied == 0) {
+            // Kernel advertised batching but lacks it: resend below, one record per ioctl
+            LOG_WARN("HymoFS batch ioctl unsupported, falling back to single rules");
+            batching_ = false;
+            break;
+        }
+
+        // Skip what was applied and the record that failed, then go on with the rest
+        unsigned int skip = std::min(arg.applied + 1, arg.count);
+        failures_++;
+        flush_failed_ = true;
+        for (unsigned int i = 0; i < skip; ++i) {
+            hymo_batch_record rec;
+            memcpy(&rec, batch_.data() + off, sizeof(rec));
+            off += rec.reclen;
+        }
+        sent += skip;
+    }
+
+    if (!batching_ && sent < batch_count_) {
+        for_each_record(batch_.data() + off, batch_.size() - off, batch_count_ - sent,
+                        [&](unsigned int, int op, const char* src, const char* target, int type) {
+            send_single(op, src, target, type);
+            return true;
+        });
+    }
+
+    batch_.clear();
+    batch_count_ = 0;
+    bool ok = !flush_failed_;
+    flush_failed_ = false;
+    return ok;
+}
+
 } // namespace hymo
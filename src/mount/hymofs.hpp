@@ -2,6 +2,8 @@
 
 #include <string>
 #include <vector>
+#include <cstddef>
+#include <functional>
 #include <filesystem>
 #include "defs.hpp"
 
@@ -9,6 +11,9 @@ namespace fs = std::filesystem;
 
 namespace hymo {
 
+class RuleTrie;
+struct HymoRules;
+
 enum class HymoFSStatus {
     Available,
     NotPresent,
@@ -16,6 +21,13 @@ enum class HymoFSStatus {
     ModuleTooOld
 };
 
+struct HymoRuleEntry {
+    std::string kind;   // "add", "hide", ... as listed by the kernel
+    std::string src;    // virtual path
+    std::string target; // backing file, add rules only
+    int type = 0;       // DT_* of add rules, 0 if not listed
+};
+
 class HymoFS {
 public:
     static constexpr int EXPECTED_PROTOCOL_VERSION = HYMO_PROTOCOL_VERSION;
@@ -24,20 +36,81 @@ public:
     static HymoFSStatus check_status();
     static bool is_available();
     static int get_protocol_version();
+    // Whether the kernel advertises that add rules of type DT_DIR redirect a whole
+    // directory (a feature query, not a protocol version)
+    static bool supports_dir_rules();
     static bool clear_rules();
     static bool add_rule(const std::string& src, const std::string& target, int type = 0);
     static bool delete_rule(const std::string& src);
     static bool hide_path(const std::string& path);
     
-    // Helper to recursively walk a directory and generate rules
-    static bool add_rules_from_directory(const fs::path& target_base, const fs::path& module_dir);
+    // Helper to recursively walk a directory and generate rules. With compact, a
+    // directory absent from the system gets one directory rule instead of one per file.
+    // With rules, paths whose rule gives a mode other than hymofs are left out. The
+    // rules sent are appended to added, if given, and then false if any was rejected.
+    static bool add_rules_from_directory(const fs::path& target_base, const fs::path& module_dir,
+                                         bool compact = false, const RuleTrie* rules = nullptr,
+                                         HymoRules* added = nullptr);
     static bool remove_rules_from_directory(const fs::path& target_base, const fs::path& module_dir);
     
     // Inspection methods
     static std::string get_active_rules();
+    // Stream the kernel's rule list in chunks, without holding it in memory; fn may
+    // return false to stop early. False if the list could not be read.
+    static bool list_rules(const std::function<bool(const HymoRuleEntry&)>& fn);
     static bool set_debug(bool enable);
     static bool set_stealth(bool enable);
     static bool hide_overlay_xattrs(const std::string& path);
+
+    // Send all control requests to a file-backed stand-in for the kernel device that
+    // logs rules as text and speaks the given protocol version. Also enabled by the
+    // HYMO_SIM_DEV (and optional HYMO_SIM_PROTOCOL and HYMO_SIM_FEATURES, a feature
+    // bit mask) environment variables. An empty
+    // file goes back to the real device.
+    static void simulate_device(const fs::path& file, int protocol_version);
+};
+
+// Rule submission over one open control fd. With a kernel that supports batching,
+// records are queued and sent many per ioctl (in order); otherwise each call is
+// sent straight away. Failed records are counted, not retried.
+class HymoFSSession {
+public:
+    // Most bytes of records sent in one batch ioctl
+    static constexpr size_t BATCH_BYTES = 64 * 1024;
+
+    HymoFSSession();
+    ~HymoFSSession();
+    HymoFSSession(const HymoFSSession&) = delete;
+    HymoFSSession& operator=(const HymoFSSession&) = delete;
+
+    bool is_open() const { return fd_ >= 0; }
+    bool batching() const { return batching_; }
+
+    // Queue (or send) a record; false only if it was sent and rejected
+    bool add_rule(const std::string& src, const std::string& target, int type = 0);
+    bool delete_rule(const std::string& src);
+    bool hide_path(const std::string& path);
+    // Flush, then drop every rule in the kernel
+    bool clear();
+    // Send queued records; false if any record since the last flush failed
+    bool flush();
+
+    size_t records() const { return records_; }
+    size_t ioctls() const { return ioctls_; }
+    size_t failures() const { return failures_; }
+
+private:
+    bool submit(int op, const std::string& src, const std::string* target, int type);
+    bool send_single(int op, const char* src, const char* target, int type);
+
+    int fd_ = -1;
+    bool batching_ = false;
+    std::vector<char> batch_;
+    unsigned int batch_count_ = 0;
+    bool flush_failed_ = false;
+    size_t records_ = 0;
+    size_t ioctls_ = 0;
+    size_t failures_ = 0;
 };
 
 } // namespace hymo
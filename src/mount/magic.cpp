@@ -2,6 +2,7 @@
 #include "magic.hpp"
 #include "../defs.hpp"
 #include "../utils.hpp"
+#include "../core/module_tree.hpp"
 #include <fstream>
 #include <sys/mount.h>
 #include <sys/stat.h>
@@ -63,7 +64,48 @@ static NodeFileType get_file_type(const fs::path& path) {
     }
 }
 
+// Same as collect_module_files, for the index entries [begin, end) listing module_dir
+static bool collect_indexed_files(Node& node, const fs::path& module_dir, const ModuleTree& tree,
+                                  uint32_t begin, uint32_t end) {
+    const auto& entries = tree.entries();
+    bool has_file = false;
+    
+    for (uint32_t i = begin; i < end; i = entries[i].end) {
+        const TreeEntry& e = entries[i];
+        Node child;
+        child.name = e.name();
+        child.module_path = module_dir / child.name;
+        
+        if (e.flags & TreeEntry::WHITEOUT) child.file_type = NodeFileType::Whiteout;
+        else if (e.is_dir()) child.file_type = NodeFileType::Directory;
+        else if (S_ISLNK(e.mode)) child.file_type = NodeFileType::Symlink;
+        else child.file_type = NodeFileType::RegularFile;
+        
+        if (child.file_type == NodeFileType::Directory) {
+            child.replace = e.flags & TreeEntry::REPLACE;
+            has_file |= collect_indexed_files(child, child.module_path, tree, i + 1, e.end) || child.replace;
+        } else {
+            has_file = true;
+        }
+        
+        node.children[child.name] = child;
+    }
+    
+    return has_file;
+}
+
 static bool collect_module_files(Node& node, const fs::path& module_dir) {
+    // Module content that was indexed this run needs no further walking
+    std::string rel;
+    const ModuleTree* tree = ModuleIndex::global().resolve(module_dir, rel);
+    if (tree && tree->complete()) {
+        long i = tree->find(rel);
+        if (rel.empty() || (i >= 0 && !S_ISLNK(tree->entries()[i].mode))) {
+            auto [begin, end] = tree->subtree(rel);
+            return collect_indexed_files(node, module_dir, *tree, begin, end);
+        }
+    }
+    
     if (!fs::exists(module_dir) || !fs::is_directory(module_dir)) {
         return false;
     }
@@ -1,6 +1,8 @@
 // utils.cpp - Utility functions implementation
 #include "utils.hpp"
 #include "defs.hpp"
+#include "copy_engine.hpp"
+#include "walker.hpp"
 #include <iostream>
 #include <fstream>
 #include <cstring>
@@ -11,9 +13,18 @@
 #include <sys/prctl.h>
 #include <sys/ioctl.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/file.h>
+#include <linux/mount.h>
+#include <linux/loop.h>
 #include <set>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <map>
 
 namespace hymo {
 
@@ -46,6 +57,8 @@ void Logger::log(const std::string& level, const std::string& message) {
     
     std::string log_line = std::string("[") + time_buf + "] [" + level + "] " + message + "\n";
     
+    // Sync workers log concurrently; keep lines whole
+    std::lock_guard<std::mutex> lock(mutex_);
     if (log_file_ && log_file_->is_open()) {
         *log_file_ << log_line;
         log_file_->flush();
@@ -67,6 +80,92 @@ bool ensure_dir_exists(const fs::path& path) {
     }
 }
 
+bool write_file_atomic(const fs::path& file, const std::string& data) {
+    if (!ensure_dir_exists(file.parent_path())) {
+        return false;
+    }
+    std::string tmp = file.string() + ".XXXXXX";
+    int fd = mkostemp(tmp.data(), O_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARN("Cannot create temp file for " + file.string() + ": " + strerror(errno));
+        return false;
+    }
+    bool ok = fchmod(fd, 0644) == 0;
+    for (size_t off = 0; ok && off < data.size();) {
+        ssize_t n = write(fd, data.data() + off, data.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) off += n;
+    }
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+        LOG_WARN("Failed to write " + file.string() + ": " + strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> split_tabs(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;) {
+        size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+        if (tab == std::string::npos) break;
+        start = tab + 1;
+    }
+    return fields;
+}
+
+namespace {
+
+struct HeldLock {
+    int fd = -1;
+    int depth = 0;
+};
+
+std::mutex g_locks_mutex;
+std::map<std::string, HeldLock> g_locks; // path -> lock this process holds
+
+} // namespace
+
+FileLock::FileLock(const fs::path& file) : path_(file.string()) {
+    std::lock_guard<std::mutex> lock(g_locks_mutex);
+    HeldLock& held = g_locks[path_];
+    if (held.depth == 0) {
+        ensure_dir_exists(file.parent_path());
+        held.fd = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (held.fd < 0) {
+            LOG_WARN("Cannot open lock " + path_ + ": " + strerror(errno));
+            g_locks.erase(path_);
+            return;
+        }
+        int ret;
+        do {
+            ret = flock(held.fd, LOCK_EX);
+        } while (ret != 0 && errno == EINTR);
+        if (ret != 0) {
+            LOG_WARN("Cannot lock " + path_ + ": " + strerror(errno));
+            close(held.fd);
+            g_locks.erase(path_);
+            return;
+        }
+    }
+    held.depth++;
+    held_ = true;
+}
+
+FileLock::~FileLock() {
+    if (!held_) return;
+    std::lock_guard<std::mutex> lock(g_locks_mutex);
+    auto it = g_locks.find(path_);
+    if (it != g_locks.end() && --it->second.depth == 0) {
+        close(it->second.fd);
+        g_locks.erase(it);
+    }
+}
+
 bool lsetfilecon(const fs::path& path, const std::string& context) {
 #ifdef __ANDROID__
     if (lsetxattr(path.c_str(), SELINUX_XATTR, context.c_str(), context.length(), 0) == 0) {
@@ -126,22 +225,168 @@ bool mount_tmpfs(const fs::path& target) {
     return true;
 }
 
-bool has_files_recursive(const fs::path& path) {
-    if (!fs::exists(path) || !fs::is_directory(path)) {
+#if defined(__NR_open_tree) && defined(__NR_move_mount) && defined(__NR_mount_setattr)
+// Clone src into a detached mount, restrict it, then attach it in one step so
+// the target never shows a writable intermediate state
+static bool bind_mount_detached(const fs::path& src, const fs::path& target) {
+    int fd = syscall(__NR_open_tree, AT_FDCWD, src.c_str(), OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (fd < 0) {
         return false;
     }
     
-    try {
-        for (const auto& entry : fs::recursive_directory_iterator(path)) {
-            if (fs::is_regular_file(entry) || fs::is_symlink(entry)) {
-                return true;
+    struct mount_attr attr = {};
+    attr.attr_set = MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV;
+    bool ok = syscall(__NR_mount_setattr, fd, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr, sizeof(attr)) == 0 &&
+              syscall(__NR_move_mount, fd, "", AT_FDCWD, target.c_str(), MOVE_MOUNT_F_EMPTY_PATH) == 0;
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return ok;
+}
+#endif
+
+bool bind_mount_readonly(const fs::path& src, const fs::path& target) {
+    if (!ensure_dir_exists(target)) {
+        return false;
+    }
+    
+#if defined(__NR_open_tree) && defined(__NR_move_mount) && defined(__NR_mount_setattr)
+    if (bind_mount_detached(src, target)) {
+        return true;
+    }
+    if (errno != ENOSYS) {
+        LOG_DEBUG("open_tree bind failed for " + src.string() + ": " + strerror(errno));
+    }
+#endif
+    
+    // Pre-5.12 kernels: classic bind followed by a read-only remount
+    if (mount(src.c_str(), target.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+        LOG_ERROR("Failed to bind " + src.string() + " to " + target.string() + ": " + strerror(errno));
+        return false;
+    }
+    if (mount(nullptr, target.c_str(), nullptr, MS_REMOUNT | MS_BIND | MS_RDONLY | MS_NOSUID | MS_NODEV, nullptr) != 0) {
+        LOG_ERROR("Failed to make bind read-only at " + target.string() + ": " + strerror(errno));
+        umount2(target.c_str(), MNT_DETACH);
+        return false;
+    }
+    return true;
+}
+
+bool is_mount_point(const fs::path& path) {
+    struct stat st, parent_st;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+    if (lstat(path.parent_path().c_str(), &parent_st) != 0) {
+        return false;
+    }
+    // Only detects mounts of another filesystem, which is all the mirror ever holds
+    return st.st_dev != parent_st.st_dev;
+}
+
+int attach_loop_device(const fs::path& image, bool read_only, std::string& dev_path) {
+    int image_fd = open(image.c_str(), (read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    if (image_fd < 0) {
+        LOG_ERROR("Failed to open image " + image.string() + ": " + strerror(errno));
+        return -1;
+    }
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0) {
+        LOG_ERROR("Failed to open /dev/loop-control: " + std::string(strerror(errno)));
+        close(image_fd);
+        return -1;
+    }
+    
+    int loop_fd = -1;
+    // Another process may grab the same free device; retry with the next one
+    for (int attempt = 0; attempt < 8 && loop_fd < 0; ++attempt) {
+        int num = ioctl(ctl, LOOP_CTL_GET_FREE);
+        if (num < 0) break;
+        
+        // Android keeps loop nodes under /dev/block
+        for (const char* fmt : {"/dev/block/loop%d", "/dev/loop%d"}) {
+            char path[64];
+            snprintf(path, sizeof(path), fmt, num);
+            int fd = open(path, (read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+            if (fd < 0) continue;
+            
+            struct loop_info64 info = {};
+            info.lo_flags = LO_FLAGS_AUTOCLEAR | (read_only ? LO_FLAGS_READ_ONLY : 0);
+            strncpy((char*)info.lo_file_name, image.c_str(), LO_NAME_SIZE - 1);
+            
+            bool attached = false;
+#ifdef LOOP_CONFIGURE
+            struct loop_config config = {};
+            config.fd = image_fd;
+            config.info = info;
+            attached = ioctl(fd, LOOP_CONFIGURE, &config) == 0;
+            if (!attached && errno == EBUSY) {
+                close(fd);
+                break;
+            }
+#endif
+            if (!attached && ioctl(fd, LOOP_SET_FD, image_fd) == 0) {
+                attached = ioctl(fd, LOOP_SET_STATUS64, &info) == 0;
+                if (!attached) ioctl(fd, LOOP_CLR_FD, 0);
+            }
+            if (attached) {
+                loop_fd = fd;
+                dev_path = path;
+            } else {
+                close(fd);
             }
+            break;
         }
-    } catch (...) {
-        return true;
     }
     
-    return false;
+    close(ctl);
+    close(image_fd);
+    if (loop_fd < 0) {
+        LOG_ERROR("Failed to attach loop device for " + image.string());
+    }
+    return loop_fd;
+}
+
+bool mount_erofs_image(const fs::path& image, const fs::path& target) {
+    if (!ensure_dir_exists(target)) {
+        return false;
+    }
+    
+    std::string dev;
+    int loop_fd = attach_loop_device(image, true, dev);
+    if (loop_fd < 0) {
+        return false;
+    }
+    
+    bool ok = mount(dev.c_str(), target.c_str(), "erofs", MS_RDONLY | MS_NOSUID | MS_NODEV, nullptr) == 0;
+    if (!ok) {
+        LOG_ERROR("Failed to mount erofs " + image.string() + " at " + target.string() + ": " + strerror(errno));
+    }
+    // With autoclear the device goes away on unmount (or right here if the mount failed)
+    close(loop_fd);
+    return ok;
+}
+
+uint64_t allocated_size_recursive(const fs::path& path) {
+    uint64_t total = 0;
+    walk_tree(path, [&](const WalkEntry& entry) {
+        total += (uint64_t)entry.st.st_blocks * 512;
+        return WalkAction::Continue;
+    });
+    return total;
+}
+
+bool has_files_recursive(const fs::path& path) {
+    bool found = false;
+    std::error_code ec = walk_tree(path, [&](const WalkEntry& entry) {
+        if (S_ISREG(entry.st.st_mode) || S_ISLNK(entry.st.st_mode)) {
+            found = true;
+            return WalkAction::Stop;
+        }
+        return WalkAction::Continue;
+    });
+    // A tree we cannot read completely might still have content
+    return found || (ec && ec != std::errc::no_such_file_or_directory && ec != std::errc::not_a_directory);
 }
 
 bool mount_image(const fs::path& image_path, const fs::path& target) {
@@ -162,6 +407,63 @@ bool mount_image(const fs::path& image_path, const fs::path& target) {
     return true;
 }
 
+int run_command(const std::vector<std::string>& argv, std::string* output) {
+    if (argv.empty()) {
+        return -1;
+    }
+    
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    
+    std::vector<char*> args;
+    for (const auto& a : argv) args.push_back(const_cast<char*>(a.c_str()));
+    args.push_back(nullptr);
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(output ? pipefd[1] : null_fd, STDOUT_FILENO);
+        dup2(output ? pipefd[1] : null_fd, STDERR_FILENO);
+        execv(args[0], args.data());
+        _exit(127);
+    }
+    
+    close(pipefd[1]);
+    char buf[256];
+    ssize_t n;
+    while ((n = read(pipefd[0], buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (output) output->append(buf, n);
+    }
+    close(pipefd[0]);
+    
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+std::string find_executable(const std::vector<std::string>& candidates) {
+    for (const auto& path : candidates) {
+        if (access(path.c_str(), X_OK) == 0) {
+            return path;
+        }
+    }
+    return "";
+}
+
 bool repair_image(const fs::path& image_path) {
     LOG_INFO("Running e2fsck on " + image_path.string());
     
@@ -194,6 +496,85 @@ bool repair_image(const fs::path& image_path) {
     return false;
 }
 
+bool sync_file(const fs::path& src, const fs::path& dst) {
+    struct stat st;
+    if (lstat(src.c_str(), &st) != 0) {
+        LOG_ERROR("sync_file: cannot stat " + src.string() + ": " + strerror(errno));
+        return false;
+    }
+    
+    // Never write through an existing dst: it may be a hardlink shared with other files
+    if (unlink(dst.c_str()) != 0 && errno != ENOENT) {
+        LOG_ERROR("sync_file: cannot replace " + dst.string() + ": " + strerror(errno));
+        return false;
+    }
+    
+    try {
+        if (S_ISLNK(st.st_mode)) {
+            fs::create_symlink(fs::read_symlink(src), dst);
+        } else if (S_ISREG(st.st_mode)) {
+            // Mode and label are applied on the open fd by the copy engine
+            return copy_file_fast(src, dst, st.st_mode, DEFAULT_SELINUX_CONTEXT);
+        } else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode) || S_ISFIFO(st.st_mode)) {
+            // Whiteouts (0:0 char devices) must survive the copy
+            if (mknod(dst.c_str(), st.st_mode, st.st_rdev) != 0) {
+                LOG_ERROR("sync_file: mknod failed for " + dst.string() + ": " + strerror(errno));
+                return false;
+            }
+        } else {
+            LOG_DEBUG("sync_file: skipping unsupported file type " + src.string());
+            return true;
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("sync_file failed: " + std::string(e.what()));
+        return false;
+    }
+    
+    lsetfilecon(dst, DEFAULT_SELINUX_CONTEXT);
+    return true;
+}
+
+bool hash_file(const fs::path& path, uint64_t& hash) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    // 64-bit multiply/rotate mix over 8-byte words; not cryptographic, only
+    // used to detect changed or identical payloads
+    constexpr uint64_t PRIME = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = 0xCBF29CE484222325ULL;
+    uint64_t total = 0;
+    static thread_local char buf[64 * 1024];
+    
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        size_t i = 0;
+        for (; i + 8 <= (size_t)n; i += 8) {
+            uint64_t w;
+            memcpy(&w, buf + i, 8);
+            h = ((h ^ w) * PRIME);
+            h = (h << 31) | (h >> 33);
+        }
+        for (; i < (size_t)n; ++i) {
+            h = (h ^ (unsigned char)buf[i]) * PRIME;
+        }
+        total += n;
+    }
+    close(fd);
+    
+    if (n < 0) {
+        return false;
+    }
+    
+    h ^= total;
+    h ^= h >> 29;
+    h *= PRIME;
+    h ^= h >> 32;
+    hash = h;
+    return true;
+}
+
 static bool native_cp_r(const fs::path& src, const fs::path& dst) {
     try {
         if (!fs::exists(dst)) {
@@ -205,19 +586,12 @@ static bool native_cp_r(const fs::path& src, const fs::path& dst) {
         for (const auto& entry : fs::directory_iterator(src)) {
             auto dst_path = dst / entry.path().filename();
             
-            if (fs::is_directory(entry)) {
-                native_cp_r(entry.path(), dst_path);
-            } else if (fs::is_symlink(entry)) {
-                auto link_target = fs::read_symlink(entry.path());
-                if (fs::exists(dst_path)) {
-                    fs::remove(dst_path);
+            if (entry.is_directory() && !entry.is_symlink()) {
+                if (!native_cp_r(entry.path(), dst_path)) {
+                    return false;
                 }
-                fs::create_symlink(link_target, dst_path);
-                lsetfilecon(dst_path, DEFAULT_SELINUX_CONTEXT);
-            } else {
-                fs::copy_file(entry.path(), dst_path, fs::copy_options::overwrite_existing);
-                fs::permissions(dst_path, fs::status(entry.path()).permissions());
-                lsetfilecon(dst_path, DEFAULT_SELINUX_CONTEXT);
+            } else if (!sync_file(entry.path(), dst_path)) {
+                return false;
             }
         }
         return true;
@@ -237,6 +611,55 @@ bool sync_dir(const fs::path& src, const fs::path& dst) {
     return native_cp_r(src, dst);
 }
 
+// Worker pool
+unsigned int resolve_worker_count(int requested, size_t jobs) {
+    unsigned int workers;
+    if (requested > 0) {
+        workers = static_cast<unsigned int>(requested);
+    } else {
+        // Sync is dominated by small-file I/O latency, not CPU, so a few
+        // threads beyond the core count would not help on eMMC/UFS either
+        workers = std::min(std::max(std::thread::hardware_concurrency(), 1u), 8u);
+    }
+    if (jobs < workers) {
+        workers = static_cast<unsigned int>(jobs);
+    }
+    return std::max(workers, 1u);
+}
+
+void run_parallel(size_t count, unsigned int workers, const std::function<void(size_t)>& task) {
+    if (count == 0) return;
+
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+            try {
+                task(i);
+            } catch (const std::exception& e) {
+                LOG_ERROR("Worker task " + std::to_string(i) + " failed: " + e.what());
+            } catch (...) {
+                LOG_ERROR("Worker task " + std::to_string(i) + " failed");
+            }
+        }
+    };
+
+    workers = std::max(1u, std::min<unsigned int>(workers, count));
+    if (workers == 1) {
+        worker();
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (unsigned int t = 1; t < workers; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& th : threads) {
+        th.join();
+    }
+}
+
 // Process utilities
 bool camouflage_process(const std::string& name) {
     if (prctl(PR_SET_NAME, name.c_str(), 0, 0, 0) == 0) {
@@ -352,4 +775,25 @@ bool ksu_nuke_sysfs(const std::string& target) {
 #endif
 }
 
+std::string json_escape(const std::string& s) {
+    std::string o;
+    o.reserve(s.size() + 2);
+    for (char c : s) {
+        if (c == '"') o += "\\\"";
+        else if (c == '\\') o += "\\\\";
+        else if (c == '\b') o += "\\b";
+        else if (c == '\f') o += "\\f";
+        else if (c == '\n') o += "\\n";
+        else if (c == '\r') o += "\\r";
+        else if (c == '\t') o += "\\t";
+        else if ((unsigned char)c < 0x20) {
+            char buf[7];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            o += buf;
+        }
+        else o += c;
+    }
+    return o;
+}
+
 } // namespace hymo
@@ -4,6 +4,10 @@
 #include <string>
 #include <filesystem>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <cstdint>
 
 namespace fs = std::filesystem;
 
@@ -20,6 +24,7 @@ private:
     Logger() = default;
     bool verbose_ = false;
     std::unique_ptr<std::ofstream> log_file_;
+    std::mutex mutex_;
 };
 
 #define LOG_INFO(msg) Logger::getInstance().log("INFO", msg)
@@ -34,18 +39,65 @@ bool lsetfilecon(const fs::path& path, const std::string& context);
 std::string lgetfilecon(const fs::path& path);
 bool copy_path_context(const fs::path& src, const fs::path& dst);
 
+// Replace file with data via a uniquely named temp file in the same directory and
+// rename(), so concurrent writers never mix their contents
+bool write_file_atomic(const fs::path& file, const std::string& data);
+// Fields of a line in the tab-separated run file formats (always at least one)
+std::vector<std::string> split_tabs(const std::string& line);
+
+// Exclusive flock() on file (created if missing), held until destruction. Blocks
+// until other processes release it. Nested locks of the same file within this
+// process share the outermost one.
+class FileLock {
+public:
+    explicit FileLock(const fs::path& file);
+    ~FileLock();
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    bool held() const { return held_; }
+
+private:
+    std::string path_;
+    bool held_ = false;
+};
+
 // Mount utilities
 bool mount_tmpfs(const fs::path& target);
 bool mount_image(const fs::path& image_path, const fs::path& target);
+// Read-only, nosuid, nodev recursive bind of src onto target (detached-tree API when available)
+bool bind_mount_readonly(const fs::path& src, const fs::path& target);
+// True if path is the root of a mount from a different filesystem than its parent
+bool is_mount_point(const fs::path& path);
+// Attach image to a free loop device (auto-cleared on last close/unmount).
+// Returns an open fd for the device and its path in dev_path, or -1.
+int attach_loop_device(const fs::path& image, bool read_only, std::string& dev_path);
+bool mount_erofs_image(const fs::path& image, const fs::path& target);
 bool repair_image(const fs::path& image_path);
+// fork/exec argv[0] (absolute path) without a shell; returns its exit code or -1.
+// stdout and stderr are captured into output when given, discarded otherwise.
+int run_command(const std::vector<std::string>& argv, std::string* output = nullptr);
+// First executable among the given absolute paths, or "" if none
+std::string find_executable(const std::vector<std::string>& candidates);
 bool sync_dir(const fs::path& src, const fs::path& dst);
+// Copy a single non-directory entry (file, symlink or device node), replacing dst
+bool sync_file(const fs::path& src, const fs::path& dst);
+bool hash_file(const fs::path& path, uint64_t& hash);
 bool has_files_recursive(const fs::path& path);
+// Bytes allocated on disk by path and everything below it (symlinks not followed)
+uint64_t allocated_size_recursive(const fs::path& path);
 
 // KSU utilities
 bool send_unmountable(const fs::path& target);
 bool ksu_nuke_sysfs(const std::string& target);
 int grab_ksu_fd();
 
+// Worker pool
+// Resolve a worker count: 0 (auto) picks min(cpu count, 8), always clamped to [1, jobs]
+unsigned int resolve_worker_count(int requested, size_t jobs);
+// Run task(i) for i in [0, count) on at most `workers` threads; blocks until all finish
+void run_parallel(size_t count, unsigned int workers, const std::function<void(size_t)>& task);
+
 // Process utilities
 bool camouflage_process(const std::string& name);
 
@@ -54,4 +106,7 @@ fs::path select_temp_dir();
 bool ensure_temp_dir(const fs::path& temp_dir);
 void cleanup_temp_dir(const fs::path& temp_dir);
 
+// Escape s for use inside a JSON string literal
+std::string json_escape(const std::string& s);
+
 } // namespace hymo
@@ -0,0 +1,131 @@
+// walker.cpp - dirfd-relative directory tree walker implementation
+#include "walker.hpp"
+#include "io_ring.hpp"
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace hymo {
+
+namespace {
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct DirEntry {
+    std::string name;
+    unsigned char type;
+};
+
+class FdGuard {
+public:
+    explicit FdGuard(int fd) : fd_(fd) {}
+    ~FdGuard() { if (fd_ >= 0) close(fd_); }
+    FdGuard(const FdGuard&) = delete;
+    FdGuard& operator=(const FdGuard&) = delete;
+    int get() const { return fd_; }
+private:
+    int fd_;
+};
+
+// All names in the directory behind fd, without "." and ".."
+int read_dir(int fd, std::vector<DirEntry>& out) {
+    // Fully consumed before the caller recurses, so one buffer per thread is enough
+    alignas(linux_dirent64) static thread_local char buf[32 * 1024];
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (n == 0) return 0;
+
+        for (long off = 0; off < n;) {
+            auto* d = reinterpret_cast<linux_dirent64*>(buf + off);
+            off += d->d_reclen;
+            const char* name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            out.push_back(DirEntry{name, d->d_type});
+        }
+    }
+}
+
+// Returns 0 to keep going, -1 if the callback asked to stop, or an errno
+int walk_dir(const fs::path& root, int fd, std::string& rel, const WalkFn& fn) {
+    std::vector<DirEntry> entries;
+    if (int err = read_dir(fd, entries)) {
+        return err;
+    }
+
+    // Stat the whole directory in one ring submission when io_uring is in use
+    std::vector<struct stat> sts(entries.size());
+    std::vector<int> errs(entries.size(), 0);
+    if (IoRing* ring = IoRing::for_thread(); ring && entries.size() > 1) {
+        std::vector<std::string> names;
+        names.reserve(entries.size());
+        for (const auto& e : entries) names.push_back(e.name);
+        ring->stat_batch(fd, names, sts, errs);
+    } else {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (fstatat(fd, entries[i].name.c_str(), &sts[i], AT_SYMLINK_NOFOLLOW) != 0) {
+                errs[i] = errno;
+            }
+        }
+    }
+
+    size_t base_len = rel.size();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (errs[i] == ENOENT) continue; // Removed since getdents
+        if (errs[i] != 0) return errs[i];
+
+        const DirEntry& e = entries[i];
+        if (base_len > 0) rel += '/';
+        rel += e.name;
+
+        WalkAction action = fn(WalkEntry{root, rel, e.name.c_str(), e.type, sts[i], fd});
+        if (action == WalkAction::Stop) return -1;
+
+        if (action == WalkAction::Continue && S_ISDIR(sts[i].st_mode)) {
+            int child = openat(fd, e.name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (child < 0) {
+                if (errno != ENOENT) return errno;
+            } else {
+                FdGuard guard(child);
+                int ret = walk_dir(root, child, rel, fn);
+                if (ret != 0) return ret;
+            }
+        }
+        rel.resize(base_len);
+    }
+    return 0;
+}
+
+} // namespace
+
+std::error_code walk_tree(const fs::path& root, const WalkFn& fn) {
+    int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::error_code(errno, std::generic_category());
+    }
+    FdGuard guard(fd);
+
+    std::string rel;
+    int ret = walk_dir(root, fd, rel, fn);
+    if (ret > 0) {
+        return std::error_code(ret, std::generic_category());
+    }
+    return {};
+}
+
+} // namespace hymo
@@ -0,0 +1,39 @@
+// walker.hpp - dirfd-relative directory tree walker
+#pragma once
+
+#include <string>
+#include <functional>
+#include <filesystem>
+#include <system_error>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+struct WalkEntry {
+    const fs::path& root;
+    const std::string& rel;  // relative to root, "system/bin/sh"; never starts with '/'
+    const char* name;        // last component of rel
+    unsigned char d_type;    // DT_* as reported by getdents64 (may be DT_UNKNOWN)
+    const struct stat& st;   // lstat() of the entry
+    int dir_fd;              // open fd of the containing directory, for *at() calls
+
+    fs::path path() const { return root / rel; }
+};
+
+enum class WalkAction {
+    Continue,
+    SkipSubtree, // don't descend into this directory
+    Stop         // end the walk, walk_tree returns success
+};
+
+using WalkFn = std::function<WalkAction(const WalkEntry&)>;
+
+// Pre-order walk of everything below root (root itself is not reported). Symlinks
+// are never followed and entries are reported in directory order. Entries that
+// vanish while walking are skipped; any other failure ends the walk and is
+// returned. Never throws.
+std::error_code walk_tree(const fs::path& root, const WalkFn& fn);
+
+} // namespace hymo
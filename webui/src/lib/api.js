@@ -27,6 +27,16 @@ function serializeKvConfig(config) {
   output += `ignore_protocol_mismatch = ${config.ignore_protocol_mismatch ? 'true' : 'false'}\n`;
   output += `enable_kernel_debug = ${config.enable_kernel_debug ? 'true' : 'false'}\n`;
   output += `enable_stealth = ${config.enable_stealth ? 'true' : 'false'}\n`;
+  output += `sync_threads = ${Number.isInteger(config.sync_threads) ? config.sync_threads : 0}\n`;
+  output += `sync_hash = ${config.sync_hash ? 'true' : 'false'}\n`;
+  if (config.copy_strategy) output += `copy_strategy = "${config.copy_strategy}"\n`;
+  if (config.io_backend) output += `io_backend = "${config.io_backend}"\n`;
+  output += `enable_dedup = ${config.enable_dedup === false ? 'false' : 'true'}\n`;
+  if (config.mirror_backend) output += `mirror_backend = "${config.mirror_backend}"\n`;
+  output += `image_journal = ${config.image_journal ? 'true' : 'false'}\n`;
+  output += `trim_image = ${config.trim_image ? 'true' : 'false'}\n`;
+  output += `plan_cache = ${config.plan_cache === false ? 'false' : 'true'}\n`;
+  output += `compact_rules = ${config.compact_rules ? 'true' : 'false'}\n`;
   
   if (config.partitions && Array.isArray(config.partitions)) {
     output += `partitions = "${config.partitions.join(',')}"\n`;
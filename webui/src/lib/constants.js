@@ -17,6 +17,16 @@ export const DEFAULT_CONFIG = {
   ignore_protocol_mismatch: false,
   enable_kernel_debug: false,
   enable_stealth: true,
+  sync_threads: 0,
+  sync_hash: false,
+  copy_strategy: 'auto',
+  io_backend: 'auto',
+  enable_dedup: true,
+  mirror_backend: 'copy',
+  image_journal: false,
+  trim_image: false,
+  plan_cache: true,
+  compact_rules: false,
   hymofs_available: false,
   hymofs_status: 1 // 1 = NotPresent (default assumption)
 };